@@ -18,7 +18,7 @@ printf "Welcome to HorizonOS!\n" > "${ROOT_DIR}/etc/welcome"
 rm -f "${ROOT_DIR}/sbin/init"
 i686-elf-gcc \
   -nostdinc -nostdlib -ffreestanding \
-  -m32 -Ttext=0x00400000 -o "${ROOT_DIR}/sbin/init" \
+  -m32 -Ttext=0x08048000 -o "${ROOT_DIR}/sbin/init" \
   init/init.c
 
 # --- Make ext2 image as a raw "whole disk" ---------------------------------
@@ -8,15 +8,30 @@
  * It's responsible for initalizing core user services and keeping
  * the CPU busy with at least one process.
  * 
+ * Until there are services to start, init checks the process syscalls
+ * on boot: fork and the copy-on-write break, spawn (and its errors),
+ * the run queue and the handoff to the next process on exit. Started
+ * by spawn with argv[1] == "spawned" it only reports its arguments.
  */
 
 #define SYS_EXIT   1
+#define SYS_FORK   2
 #define SYS_READ   3
 #define SYS_WRITE  4
 #define SYS_OPEN   5
 #define SYS_CLOSE  6
 #define SYS_BRK    45
 #define SYS_CLEAR_VGA 500
+#define SYS_SPAWN  501
+
+#define ENOENT     2
+#define ENOEXEC    8
+
+static inline int syscall0(int num) {
+    int ret;
+    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num));
+    return ret;
+}
 
 static inline int syscall1(int num, int arg1) {
     int ret;
@@ -65,6 +80,14 @@ static inline void exit(int status) {
     __builtin_unreachable();
 }
 
+static inline int fork(void) {
+    return syscall0(SYS_FORK);
+}
+
+static inline int spawn(const char *path, const char *const argv[], const char *const envp[]) {
+    return syscall3(SYS_SPAWN, (int)path, (int)argv, (int)envp);
+}
+
 static inline unsigned int brk(unsigned int addr) {
     return syscall5(SYS_BRK, addr, 0, 0, 0, 0);
 }
@@ -79,17 +102,84 @@ static int strlen(const char *s) {
     return len;
 }
 
+static int streq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
 static void print(const char *s) {
     write(1, s, strlen(s));
 }
 
+static void check(const char *what, int ok) {
+    print("[init] ");
+    print(what);
+    print(ok ? ": ok\n" : ": FAIL\n");
+}
+
+// --------------------------------------------------
+// Process self-test
+// --------------------------------------------------
+
+// Lives in a writable segment, so fork leaves it shared copy-on-write
+static volatile int cow_value = 1;
+
+static void test_fork(void) {
+    int pid = fork();
+    if (pid == 0) {
+        // Child runs first; this write must break the COW page
+        cow_value = 2;
+        check("fork child writes its own copy", cow_value == 2);
+        exit(0);
+    }
+
+    // Resumed by the child's exit
+    check("fork returns the child's pid", pid > 0);
+    check("fork parent keeps its copy", cow_value == 1);
+}
+
+static void test_spawn(void) {
+    static const char *const argv[] = { "/sbin/init", "spawned", 0 };
+
+    check("spawn missing file fails with ENOENT", spawn("/sbin/missing", argv, 0) == -ENOENT);
+    check("spawn non-ELF fails with ENOEXEC", spawn("/etc/motd", argv, 0) == -ENOEXEC);
+    check("spawn /sbin/init", spawn("/sbin/init", argv, 0) > 0);
+
+    // The spawned process is queued behind us; a child that exits at
+    // once hands the CPU to it, and its own exit hands it back here
+    int pid = fork();
+    if (pid == 0) {
+        exit(0);
+    }
+    check("exit hands off through the run queue", pid > 0);
+}
+
 // --------------------------------------------------
 // Entry point
 // --------------------------------------------------
 
-void _start(void) {
+// Entered with argc at the top of the stack, argv right above it
+__asm__(".global _start\n"
+        "_start:\n"
+        "    push %esp\n"
+        "    call init_main\n");
+
+void init_main(const unsigned int *sp) {
+    int argc = (int)sp[0];
+    const char *const *argv = (const char *const *)&sp[1];
+
+    if (argc > 1 && streq(argv[1], "spawned")) {
+        check("spawned with its own argv", argc == 2 && streq(argv[0], "/sbin/init"));
+        exit(0);
+    }
+
     clear();
     print("Horizon init online.\n");
+    test_fork();
+    test_spawn();
     exit(0);
 }
 
@@ -4,6 +4,8 @@
 // (c) 2025 HorizonOS Project
 //
 
+#define KHEAP_SUBSYS "ext2"
+
 #include <stdint.h>
 #include <stddef.h>
 #include "../vfs/vfs.h"
@@ -133,6 +135,9 @@ typedef struct {
     
     ext2_superblock_t superblock;
     ext2_bgd_t *block_groups;
+
+    kmem_cache_t *inode_cache;  // In-memory inodes of open files
+    arena_t scratch;            // Temporary buffers of a single operation
 } ext2_state_t;
 
 static ext2_state_t ext2_state = {0};
@@ -239,6 +244,7 @@ static fs_ops_t ext2_ops = {
 static int ext2_init(void) {
     klogf("[ext2] Initializing ext2 driver...\n");
     memset(&ext2_state, 0, sizeof(ext2_state));
+    ext2_state.scratch.name = "ext2";
     return 0;
 }
 
@@ -270,6 +276,16 @@ static int ext2_mount(const char *device) {
         ext2_state.device = NULL;
         return -1;
     }
+
+    ext2_state.inode_cache = kmem_cache_create("ext2_inode", sizeof(ext2_inode_t),
+                                               0, 0, NULL);
+    if (!ext2_state.inode_cache) {
+        klogf("[ext2] ERROR: Failed to create inode cache\n");
+        kfree(ext2_state.block_groups);
+        ext2_state.block_groups = NULL;
+        ext2_state.device = NULL;
+        return -1;
+    }
     
     ext2_state.mounted = true;
     kprintf_both("[ext2] Mount successful!\n");
@@ -284,6 +300,10 @@ static void ext2_unmount(void) {
         ext2_state.block_groups = NULL;
     }
 
+    kmem_cache_destroy(ext2_state.inode_cache);
+    ext2_state.inode_cache = NULL;
+    arena_release(&ext2_state.scratch);
+
     ext2_state.device = NULL;
     ext2_state.mounted = false;
 }
@@ -303,13 +323,13 @@ static int ext2_open(const char *path, int flags, file_t *file) {
     }
     
     // Read the inode
-    ext2_inode_t *inode = (ext2_inode_t*)kalloc(sizeof(ext2_inode_t));
+    ext2_inode_t *inode = (ext2_inode_t*)kmem_cache_alloc(ext2_state.inode_cache);
     if (!inode) {
         return -1;
     }
     
     if (ext2_read_inode(inode_num, inode) < 0) {
-        kfree(inode);
+        kmem_cache_free(ext2_state.inode_cache, inode);
         return -1;
     }
     
@@ -323,7 +343,7 @@ static int ext2_open(const char *path, int flags, file_t *file) {
 
 static int ext2_close(file_t *file) {
     if (file && file->fs_data) {
-        kfree(file->fs_data);
+        kmem_cache_free(ext2_state.inode_cache, file->fs_data);
         file->fs_data = NULL;
     }
     return 0;
@@ -495,7 +515,8 @@ static int ext2_read_inode(uint32_t inode_num, ext2_inode_t *inode) {
     uint32_t offset_in_block = inode_offset % ext2_state.block_size;
     
     // Read the block containing the inode
-    uint8_t *block_buf = (uint8_t*)kalloc(ext2_state.block_size);
+    arena_mark_t mark = arena_begin(&ext2_state.scratch);
+    uint8_t *block_buf = (uint8_t*)arena_alloc(&ext2_state.scratch, ext2_state.block_size);
     if (!block_buf) {
         klogf("[ext2] ERROR: Failed to allocate inode read buffer\n");
         return -1;
@@ -503,14 +524,14 @@ static int ext2_read_inode(uint32_t inode_num, ext2_inode_t *inode) {
     
     if (ext2_read_block(inode_table_block + block_offset, block_buf) < 0) {
         klogf("[ext2] ERROR: Failed to read inode table block\n");
-        kfree(block_buf);
+        arena_reset(&ext2_state.scratch, mark);
         return -1;
     }
     
     // Copy the inode data
     memcpy(inode, block_buf + offset_in_block, sizeof(ext2_inode_t));
     
-    kfree(block_buf);
+    arena_reset(&ext2_state.scratch, mark);
     
     klogf("[ext2] Read inode %u: size=%u, mode=0x%04x\n", 
           inode_num, inode->i_size, inode->i_mode);
@@ -573,39 +594,45 @@ static int ext2_find_inode_by_path(const char *path, uint32_t *inode_num) {
  */
 static int ext2_search_directory(ext2_inode_t *dir_inode, const char *name, uint32_t *found_inode) {
     uint32_t dir_size = dir_inode->i_size;
-    uint32_t bytes_read = 0;
+    uint32_t name_len = strlen(name);
     
-    uint8_t *dir_buf = (uint8_t*)kalloc(dir_size);
+    // Entries never cross a block boundary, so scan one block at a time
+    // rather than buffering the whole directory
+    arena_mark_t mark = arena_begin(&ext2_state.scratch);
+    uint8_t *dir_buf = (uint8_t*)arena_alloc(&ext2_state.scratch, ext2_state.block_size);
     if (!dir_buf) {
         klogf("[ext2] ERROR: Failed to allocate directory buffer\n");
         return -1;
     }
     
-    if (ext2_read_inode_data(dir_inode, 0, dir_buf, dir_size) < 0) {
-        kfree(dir_buf);
-        return -1;
-    }
-    
-    while (bytes_read < dir_size) {
-        ext2_dirent_t *entry = (ext2_dirent_t*)(dir_buf + bytes_read);
-        
-        if (entry->inode == 0) {
-            bytes_read += entry->rec_len;
-            continue;
+    for (uint32_t block_start = 0; block_start < dir_size; block_start += ext2_state.block_size) {
+        int len = ext2_read_inode_data(dir_inode, block_start, dir_buf, ext2_state.block_size);
+        if (len < 0) {
+            arena_reset(&ext2_state.scratch, mark);
+            return -1;
         }
         
-        if (entry->name_len == strlen(name) && 
-            memcmp(entry->name, name, entry->name_len) == 0) {
-            *found_inode = entry->inode;
-            klogf("[ext2] Found '%s' -> inode %u\n", name, entry->inode);
-            kfree(dir_buf);
-            return 0;
+        uint32_t bytes_read = 0;
+        while (bytes_read + sizeof(ext2_dirent_t) <= (uint32_t)len) {
+            ext2_dirent_t *entry = (ext2_dirent_t*)(dir_buf + bytes_read);
+            
+            if (entry->rec_len == 0) {
+                break;  // Corrupt entry, don't spin on it
+            }
+            
+            if (entry->inode != 0 && entry->name_len == name_len &&
+                memcmp(entry->name, name, entry->name_len) == 0) {
+                *found_inode = entry->inode;
+                klogf("[ext2] Found '%s' -> inode %u\n", name, entry->inode);
+                arena_reset(&ext2_state.scratch, mark);
+                return 0;
+            }
+            
+            bytes_read += entry->rec_len;
         }
-        
-        bytes_read += entry->rec_len;
     }
     
-    kfree(dir_buf);
+    arena_reset(&ext2_state.scratch, mark);
     return -1;
 }
 
@@ -624,7 +651,8 @@ static int ext2_read_inode_data(ext2_inode_t *inode, uint32_t offset, void *buf,
     uint32_t bytes_read = 0;
     uint8_t *out = (uint8_t*)buf;
     
-    uint8_t *block_buf = (uint8_t*)kalloc(ext2_state.block_size);
+    arena_mark_t mark = arena_begin(&ext2_state.scratch);
+    uint8_t *block_buf = (uint8_t*)arena_alloc(&ext2_state.scratch, ext2_state.block_size);
     if (!block_buf) {
         return -1;
     }
@@ -643,7 +671,7 @@ static int ext2_read_inode_data(ext2_inode_t *inode, uint32_t offset, void *buf,
             memset(out + bytes_read, 0, bytes_to_read);
         } else {
             if (ext2_read_block(disk_block, block_buf) < 0) {
-                kfree(block_buf);
+                arena_reset(&ext2_state.scratch, mark);
                 return -1;
             }
             memcpy(out + bytes_read, block_buf + offset_in_block, bytes_to_read);
@@ -652,7 +680,7 @@ static int ext2_read_inode_data(ext2_inode_t *inode, uint32_t offset, void *buf,
         bytes_read += bytes_to_read;
     }
     
-    kfree(block_buf);
+    arena_reset(&ext2_state.scratch, mark);
     return bytes_read;
 }
 
@@ -674,16 +702,17 @@ static uint32_t ext2_get_block_number(ext2_inode_t *inode, uint32_t file_block)
         uint32_t indirect_block = inode->i_block[12];
         if (indirect_block == 0) return 0;
         
-        uint32_t *indirect_buf = (uint32_t*)kalloc(ext2_state.block_size);
+        arena_mark_t mark = arena_begin(&ext2_state.scratch);
+        uint32_t *indirect_buf = (uint32_t*)arena_alloc(&ext2_state.scratch, ext2_state.block_size);
         if (!indirect_buf) return 0;
         
         if (ext2_read_block(indirect_block, indirect_buf) < 0) {
-            kfree(indirect_buf);
+            arena_reset(&ext2_state.scratch, mark);
             return 0;
         }
         
         uint32_t block_num = indirect_buf[file_block];
-        kfree(indirect_buf);
+        arena_reset(&ext2_state.scratch, mark);
         return block_num;
     }
     
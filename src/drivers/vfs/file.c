@@ -1,18 +1,44 @@
+#define KHEAP_SUBSYS "vfs"
 #include "file.h"
+#include "mm/heap.h"
+#include "libk/string.h"
 
-static file_t fd_table[VFS_MAX_FDS];
+static file_t file_table[VFS_MAX_FILES];
+static fd_table_t kernel_fds;           // Until the first process runs
+static fd_table_t *current_fds = &kernel_fds;
 
 void fd_table_init(void) {
-    for (int i = 0; i < VFS_MAX_FDS; i++) {
-        fd_table[i].in_use = false;
+    for (int i = 0; i < VFS_MAX_FILES; i++) {
+        file_table[i].refs = 0;
+    }
+    memset(&kernel_fds, 0, sizeof(kernel_fds));
+    current_fds = &kernel_fds;
+}
+
+file_t *file_alloc(void) {
+    for (int i = 0; i < VFS_MAX_FILES; i++) {
+        if (file_table[i].refs == 0) {
+            file_table[i].refs = 1;
+            return &file_table[i];
+        }
     }
+    return NULL;  // Out of files
+}
+
+void file_get(file_t *file) {
+    file->refs++;
 }
 
-int fd_alloc(file_t **out) {
+void file_free(file_t *file) {
+    if (file) {
+        file->refs = 0;
+    }
+}
+
+int fd_install(file_t *file) {
     for (int i = 3; i < VFS_MAX_FDS; i++) {
-        if (!fd_table[i].in_use) {
-            fd_table[i].in_use = true;
-            *out = &fd_table[i];
+        if (!current_fds->fds[i]) {
+            current_fds->fds[i] = file;
             return i;
         }
     }
@@ -21,13 +47,51 @@ int fd_alloc(file_t **out) {
 
 void fd_free(int fd) {
     if (fd >= 0 && fd < VFS_MAX_FDS) {
-        fd_table[fd].in_use = false;
+        current_fds->fds[fd] = NULL;
     }
 }
 
 file_t* fd_get(int fd) {
-    if (fd < 0 || fd >= VFS_MAX_FDS || !fd_table[fd].in_use) {
+    if (fd < 0 || fd >= VFS_MAX_FDS) {
+        return NULL;
+    }
+    return current_fds->fds[fd];
+}
+
+fd_table_t *fd_table_create(void) {
+    fd_table_t *table = kalloc(sizeof(fd_table_t));
+    if (table) {
+        memset(table, 0, sizeof(*table));
+    }
+    return table;
+}
+
+fd_table_t *fd_table_clone(const fd_table_t *src) {
+    fd_table_t *table = kalloc(sizeof(fd_table_t));
+    if (!table) {
         return NULL;
     }
-    return &fd_table[fd];
-}
\ No newline at end of file
+
+    for (int i = 0; i < VFS_MAX_FDS; i++) {
+        table->fds[i] = src->fds[i];
+        if (table->fds[i]) {
+            file_get(table->fds[i]);
+        }
+    }
+    return table;
+}
+
+void fd_table_destroy(fd_table_t *table) {
+    if (!table) {
+        return;
+    }
+
+    for (int i = 0; i < VFS_MAX_FDS; i++) {
+        vfs_file_close(table->fds[i]);
+    }
+    kfree(table);
+}
+
+void fd_table_switch(fd_table_t *table) {
+    current_fds = table ? table : &kernel_fds;
+}
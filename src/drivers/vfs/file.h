@@ -2,14 +2,17 @@
  * @file file.h
  * @brief File Descriptor Table Management
  * 
- * Manages the global file descriptor table - the mapping between integer
- * FD numbers (what userspace uses) and actual file_t structures (what the
- * VFS uses internally).
+ * Manages the table of open files and the per-process file descriptor
+ * tables - the mapping between integer FD numbers (what userspace uses)
+ * and actual file_t structures (what the VFS uses internally).
  * 
  * When a user opens "/etc/motd", the VFS:
- * 1. Calls fd_alloc() to get a free FD slot
+ * 1. Calls file_alloc() to get a free file_t
  * 2. Fills in the file_t structure (offset, flags, fs_data)
- * 3. Returns the FD number (e.g., 3) to userspace
+ * 3. Calls fd_install() to give it an FD slot
+ * 4. Returns the FD number (e.g., 3) to userspace
+ * 
+ * Files the kernel opens for itself skip step 3 and have no FD at all.
  * 
  * When the user later calls read(3, ...), the syscall:
  * 1. Calls fd_get(3) to retrieve the file_t structure
@@ -18,9 +21,10 @@
  * Simple but critical! Without this, we'd be passing raw pointers to
  * userspace (bad idea) or have no way to track open files.
  * 
- * @note Currently global (one FD table for the whole system). Eventually
- *       this will be per-process when we have proper process management.
- *       Whenever that is, probably by summer 2026.
+ * FD lookups go through the current table, which the process code swaps
+ * along with the address space (fd_table_switch()). A forked child gets
+ * a copy of its parent's table: the descriptors are its own, the files
+ * they point to (and their offsets) are shared, like on UNIX.
  */
 
 #ifndef VFS_FILE_H
@@ -28,11 +32,18 @@
 
 #include "vfs.h"
 
+/** @brief A process's descriptors, FD number -> open file (NULL = free) */
+typedef struct fd_table {
+    file_t *fds[VFS_MAX_FDS];
+} fd_table_t;
+
 /**
- * @brief Initialize the file descriptor table
+ * @brief Initialize the file and file descriptor tables
  * 
- * Sets up the global FD table and marks standard streams (stdin, stdout,
- * stderr) as reserved. Must be called during VFS initialization.
+ * Marks every file free and makes the kernel's own FD table (used until
+ * the first process exists) current. The standard streams (stdin,
+ * stdout, stderr) are handled by the syscalls and never get a slot. Must
+ * be called during VFS initialization.
  * 
  * FD allocation after init:
  * - 0, 1, 2: Reserved for stdin, stdout, stderr
@@ -43,38 +54,68 @@
 void fd_table_init(void);
 
 /**
- * @brief Allocate a new file descriptor
+ * @brief Allocate an open file
+ * 
+ * Finds a free file_t and gives it one reference. It has no FD until
+ * it's passed to fd_install().
+ * 
+ * @return The file, or NULL if the table is full
+ */
+file_t *file_alloc(void);
+
+/**
+ * @brief Take another reference to an open file
  * 
- * Finds the next available FD slot, marks it as in-use, and returns
- * both the FD number and a pointer to the file_t structure for filling in.
+ * @param file Open file
+ */
+void file_get(file_t *file);
+
+/**
+ * @brief Free an open file
  * 
- * @param out Output parameter - receives pointer to allocated file_t
+ * Frees the slot whatever its reference count, see vfs_file_close() for
+ * dropping a reference.
+ * 
+ * @param file File from file_alloc()
+ * 
+ * @note Does NOT call the filesystem's close() function - that should
+ *       be done by the caller first!
+ */
+void file_free(file_t *file);
+
+/**
+ * @brief Give an open file a descriptor
+ * 
+ * Finds the next available FD slot of the current table and points it at
+ * file. The slot takes over the caller's reference.
+ * 
+ * @param file Open file from file_alloc()
  * @return File descriptor number (>= 3), or -1 if table is full
  * 
  * Example:
  * @code
- * file_t *file;
- * int fd = fd_alloc(&file);
- * if (fd >= 0) {
+ * file_t *file = file_alloc();
+ * if (file) {
  *     file->offset = 0;
  *     file->flags = O_RDONLY;
  *     file->fs_data = inode;
  *     file->fs_ops = &ext2_ops;
+ *     int fd = fd_install(file);
  * }
  * @endcode
  */
-int fd_alloc(file_t **out);
+int fd_install(file_t *file);
 
 /**
  * @brief Free a file descriptor
  * 
- * Marks an FD slot as available for reuse. Should be called when a file
- * is closed to prevent FD leaks.
+ * Marks an FD slot of the current table as available for reuse. The file
+ * it pointed to stays open, its reference passes to the caller.
  * 
  * @param fd File descriptor to free
  * 
- * @note Does NOT call the filesystem's close() function - that should
- *       be done by vfs_close() before calling this!
+ * @note Does NOT close the file - that should be done by vfs_close()
+ *       after calling this!
  */
 void fd_free(int fd);
 
@@ -98,4 +139,37 @@ void fd_free(int fd);
  */
 file_t* fd_get(int fd);
 
+/**
+ * @brief Make an empty FD table
+ * 
+ * @return The table, or NULL if out of memory
+ */
+fd_table_t *fd_table_create(void);
+
+/**
+ * @brief Copy an FD table for a new process
+ * 
+ * Every descriptor of the copy refers to the same file as in src, which
+ * gains a reference for it.
+ * 
+ * @param src Table to copy
+ * @return The copy, or NULL if out of memory
+ */
+fd_table_t *fd_table_clone(const fd_table_t *src);
+
+/**
+ * @brief Close every descriptor of a table and free it
+ * 
+ * @param table Table from fd_table_create() or fd_table_clone(), not the
+ *              current one (NULL is ignored)
+ */
+void fd_table_destroy(fd_table_t *table);
+
+/**
+ * @brief Make a table current
+ * 
+ * @param table Table of the process about to run, NULL for the kernel's
+ */
+void fd_table_switch(fd_table_t *table);
+
 #endif // VFS_FILE_H
\ No newline at end of file
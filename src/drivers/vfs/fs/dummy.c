@@ -37,11 +37,13 @@ static int dummy_stat(const char *path, stat_t *st) {
     if (strcmp(path, "/hello.txt") == 0) {
         st->size = strlen(hello_txt);
         st->type = VFS_FILE;
+        st->inode = 1;
         return 0;
     }
     if (strcmp(path, "/test.txt") == 0) {
         st->size = strlen(test_txt);
         st->type = VFS_FILE;
+        st->inode = 2;
         return 0;
     }
     return -1;
@@ -5,6 +5,7 @@
 
 // Mount table (for now, just root)
 static fs_ops_t *root_fs = NULL;
+static uint32_t root_dev = 0;   // Bumped on every mount, inodes of different mounts differ
 
 // Registered filesystems
 #define MAX_FS_TYPES 8
@@ -44,22 +45,45 @@ int vfs_mount(const char *fs_name, const char *device, const char *mountpoint) {
     if (fs->mount && fs->mount(device) < 0) return -1;
     
     root_fs = fs;
+    root_dev++;
     return 0;
 }
 
-int vfs_open(const char *path, int flags) {
-    if (!root_fs || !root_fs->open) return -1;
+file_t *vfs_file_open(const char *path, int flags) {
+    if (!root_fs || !root_fs->open) return NULL;
     
-    file_t *file;
-    int fd = fd_alloc(&file);
-    if (fd < 0) return -1;
+    file_t *file = file_alloc();
+    if (!file) return NULL;
     
     file->flags = flags;
     file->offset = 0;
     file->fs_ops = root_fs;
     
     if (root_fs->open(path, flags, file) < 0) {
-        fd_free(fd);
+        file_free(file);
+        return NULL;
+    }
+    
+    return file;
+}
+
+void vfs_file_close(file_t *file) {
+    if (!file || --file->refs > 0) return;
+    
+    if (file->fs_ops->close) {
+        file->fs_ops->close(file);
+    }
+    
+    file_free(file);
+}
+
+int vfs_open(const char *path, int flags) {
+    file_t *file = vfs_file_open(path, flags);
+    if (!file) return -1;
+    
+    int fd = fd_install(file);
+    if (fd < 0) {
+        vfs_file_close(file);
         return -1;
     }
     
@@ -70,11 +94,8 @@ int vfs_close(int fd) {
     file_t *file = fd_get(fd);
     if (!file) return -1;
     
-    if (file->fs_ops->close) {
-        file->fs_ops->close(file);
-    }
-    
     fd_free(fd);
+    vfs_file_close(file);
     return 0;
 }
 
@@ -85,7 +106,28 @@ int vfs_read(int fd, void *buf, size_t count) {
     return file->fs_ops->read(file, buf, count);
 }
 
+int vfs_file_pread(file_t *file, void *buf, size_t count, uint32_t offset) {
+    if (!file || !file->fs_ops->read) return -1;
+
+    // Filesystems read at file->offset, borrow it for this one call
+    uint32_t saved = file->offset;
+    file->offset = offset;
+    int n = file->fs_ops->read(file, buf, count);
+    file->offset = saved;
+
+    return n;
+}
+
+int vfs_pread(int fd, void *buf, size_t count, uint32_t offset) {
+    return vfs_file_pread(fd_get(fd), buf, count, offset);
+}
+
 int vfs_stat(const char *path, stat_t *st) {
     if (!root_fs || !root_fs->stat) return -1;
-    return root_fs->stat(path, st);
+
+    memset(st, 0, sizeof(*st));
+    if (root_fs->stat(path, st) < 0) return -1;
+
+    st->dev = root_dev;
+    return 0;
 }
\ No newline at end of file
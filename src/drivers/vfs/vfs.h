@@ -66,22 +66,28 @@
 /** @brief Seek relative to end of file */
 #define SEEK_END    2
 
-/** @brief Maximum number of open file descriptors (global, for now) */
+/** @brief Maximum number of open file descriptors per process */
 #define VFS_MAX_FDS 256
 
+/** @brief Maximum number of open files, with or without a descriptor */
+#define VFS_MAX_FILES 256
+
 typedef struct fs_ops fs_ops_t;
 
 /**
  * @brief Open file descriptor
  * 
- * Represents an open file in the system. Each process will eventually
- * have its own FD table, but for now this is global.
+ * Represents an open file in the system. Files opened by user space are
+ * reached through a descriptor (see file.h); the kernel can also hold a
+ * file without one (vfs_file_open()), which user space can't name. A
+ * file stays open while any descriptor (in any process) or kernel holder
+ * still refers to it.
  * 
  * The file struct is filesystem-agnostic - all FS-specific details are
  * hidden behind fs_data and accessed through fs_ops function pointers.
  */
 typedef struct file {
-    bool in_use;        /**< Whether this FD slot is allocated */
+    uint32_t refs;      /**< Descriptors and kernel holders, 0 = slot free */
     uint32_t offset;    /**< Current read/write position in file */
     int flags;          /**< Open flags (O_RDONLY, O_WRONLY, O_RDWR) */
     
@@ -111,7 +117,8 @@ struct dirent {
  * but simplified for our needs (no timestamps, ownership, etc. yet).
  */
 typedef struct {
-    uint32_t inode;     /**< Inode number */
+    uint32_t dev;       /**< Mounted filesystem the file is on */
+    uint32_t inode;     /**< Inode number (unique within dev) */
     uint32_t size;      /**< File size in bytes */
     uint8_t type;       /**< File type (VFS_FILE, VFS_DIR, etc.) */
     uint16_t mode;      /**< Permissions (rwxrwxrwx, not enforced yet) */
@@ -225,8 +232,9 @@ int vfs_open(const char *path, int flags);
 /**
  * @brief Close a file descriptor
  * 
- * Closes an open file and frees the FD slot. Calls the filesystem's
- * close() function to perform any necessary cleanup.
+ * Frees the FD slot and drops its reference to the file. Calls the
+ * filesystem's close() function to perform any necessary cleanup once
+ * no other descriptor refers to the file.
  * 
  * @param fd File descriptor to close
  * @return 0 on success, -1 on failure (invalid FD)
@@ -246,6 +254,56 @@ int vfs_close(int fd);
  */
 int vfs_read(int fd, void *buf, size_t count);
 
+/**
+ * @brief Read from a file at a given offset
+ * 
+ * Like vfs_read(), but reads at offset and leaves the file offset where
+ * it was. Lets a caller pick pieces out of a file (e.g. ELF segments)
+ * without seeking.
+ * 
+ * @param fd File descriptor
+ * @param buf Buffer to read into
+ * @param count Maximum number of bytes to read
+ * @param offset Position in the file to read from
+ * @return Number of bytes read, 0 at or past EOF, -1 on error
+ */
+int vfs_pread(int fd, void *buf, size_t count, uint32_t offset);
+
+/**
+ * @brief Open a file without a descriptor
+ * 
+ * Like vfs_open(), but the file is not installed in the descriptor table,
+ * so user space can't read, close or otherwise reach it. For files the
+ * kernel keeps open itself (e.g. a running executable).
+ * 
+ * @param path File path
+ * @param flags Open flags (O_RDONLY, O_WRONLY, O_RDWR)
+ * @return The open file, or NULL on failure
+ */
+file_t *vfs_file_open(const char *path, int flags);
+
+/**
+ * @brief Close a file opened with vfs_file_open()
+ * 
+ * Drops one reference; the filesystem's close() runs with the last one.
+ * 
+ * @param file Open file (NULL is ignored)
+ */
+void vfs_file_close(file_t *file);
+
+/**
+ * @brief Read from a file at a given offset, by file
+ * 
+ * vfs_pread() for a file held without a descriptor.
+ * 
+ * @param file Open file
+ * @param buf Buffer to read into
+ * @param count Maximum number of bytes to read
+ * @param offset Position in the file to read from
+ * @return Number of bytes read, 0 at or past EOF, -1 on error
+ */
+int vfs_file_pread(file_t *file, void *buf, size_t count, uint32_t offset);
+
 /**
  * @brief Write to a file
  * 
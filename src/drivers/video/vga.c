@@ -1,8 +1,9 @@
 #include "vga.h"
+#include "mm/vmm.h"
 
 #define VGA_WIDTH   80
 #define VGA_HEIGHT  25
-#define VGA_MEM     ((volatile uint16_t*)0xB8000)
+#define VGA_MEM     ((volatile uint16_t*)PHYS_TO_VIRT(0xB8000))
 #define VGA_ATTR    0x07
 
 static uint8_t cursor_row = 0;
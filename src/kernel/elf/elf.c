@@ -1,11 +1,19 @@
 #include "elf.h"
 #include "../log.h"
+#include "../errno.h"
 #include "../../mm/vmm.h"
 #include "../../mm/pmm.h"
 #include "../../libk/string.h"
+#include "../../mm/heap.h"
+#include "../../drivers/vfs/vfs.h"
 
-#define USER_VADDR_MIN  0x00400000  // 4 MB, standard ELF base
-#define USER_VADDR_MAX  0xBFFFFFFF  // just below kernel space
+#define USER_VADDR_MIN  USER_SPACE_START    // page 0 stays unmapped
+#define USER_VADDR_MAX  (USER_SPACE_END - 1)
+
+#define ELF_MAP_BATCH   32          // Frames requested from the PMM at once
+#define ELF_STACK_SIZE  (1024 * 1024)   // Reserved for the user stack, faulted in as used
+#define ELF_ARGS_MAX    (64 * 1024)     // Stack the argument frame may take
+#define ELF_MAX_PHNUM   64              // Program headers accepted
 
 // Internal ELF header validation
 static int elf_validate_header(const Elf32_Ehdr *hdr) {
@@ -17,50 +25,131 @@ static int elf_validate_header(const Elf32_Ehdr *hdr) {
 
     if (magic != ELF_MAGIC) {
         klogf("[elf] Invalid magic: 0x%x\n", magic);
-        return -1;
+        return -ENOEXEC;
     }
 
     if (hdr->e_ident[4] != ELFCLASS32) {
         klogf("[elf] Unsupported ELF class %u (expected 32)\n", hdr->e_ident[4]);
-        return -1;
+        return -ENOEXEC;
     }
 
     if (hdr->e_ident[5] != ELFDATA2LSB) {
         klogf("[elf] Unsupported endianness\n");
-        return -1;
+        return -ENOEXEC;
     }
 
     if (hdr->e_ident[6] != 1) {
         klogf("[elf] Unsupported EI_VERSION %u\n", hdr->e_ident[6]);
-        return -1;
+        return -ENOEXEC;
     }
 
     if (hdr->e_version != 1) {
         klogf("[elf] Unsupported ELF version %u\n", hdr->e_version);
-        return -1;
+        return -ENOEXEC;
     }
 
     if (hdr->e_type != ET_EXEC) {
         klogf("[elf] Not an executable (e_type=%u)\n", hdr->e_type);
-        return -1;
+        return -ENOEXEC;
     }
 
     if (hdr->e_machine != EM_386) {
         klogf("[elf] Unsupported machine %u (expected x86)\n", hdr->e_machine);
-        return -1;
+        return -ENOEXEC;
     }
 
     if (hdr->e_entry < USER_VADDR_MIN || hdr->e_entry > USER_VADDR_MAX) {
         klogf("[elf] Entry point out of user range: 0x%08x\n", hdr->e_entry);
-        return -1;
+        return -ENOEXEC;
+    }
+
+    return 0;
+}
+
+
+// Record [start, end) as an area of the new address space. Segments may
+// share pages (their boundary page, or a writable segment inside a
+// read-only one). Those stay in the area already holding them, which
+// becomes writable if this segment is: elf_protect_range() leaves such
+// pages writable, and syscalls must accept buffers in them.
+static int elf_add_area(uint32_t start, uint32_t end, uint32_t flags, vma_backing_t backing) {
+    uint32_t addr = start;
+
+    while (addr < end) {
+        bool taken = vmm_check_user(addr, 1, false);
+        uint32_t run = addr;
+        while (run < end && vmm_check_user(run, 1, false) == taken) {
+            run += 0x1000;
+        }
+
+        if (taken) {
+            if ((flags & PAGE_RW) && vmm_protect_region(addr, run, flags) < 0) {
+                return -ENOMEM;
+            }
+        } else if (vmm_add_region(addr, run, flags, backing) < 0) {
+            return -ENOMEM;
+        }
+
+        addr = run;
     }
 
     return 0;
 }
 
+// Whether segment i has a page in common with another PT_LOAD segment.
+// Such a page holds data of both, so it can't come from one file range.
+static bool elf_shares_page(const Elf32_Phdr *phdr, uint32_t phnum, uint32_t i) {
+    uint32_t start = phdr[i].p_vaddr & ~0xFFF;
+    uint32_t end = (phdr[i].p_vaddr + phdr[i].p_memsz + 0xFFF) & ~0xFFF;
+
+    for (uint32_t j = 0; j < phnum; j++) {
+        if (j == i || phdr[j].p_type != PT_LOAD || phdr[j].p_memsz == 0) {
+            continue;
+        }
+
+        uint32_t o_start = phdr[j].p_vaddr & ~0xFFF;
+        uint32_t o_end = (phdr[j].p_vaddr + phdr[j].p_memsz + 0xFFF) & ~0xFFF;
+        if (o_start < end && o_end > start) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Map a segment's file data lazily: its pages are read from the file on
+// first touch, BSS pages past it are demand-zero
+static int elf_map_segment_lazy(vma_file_t *file, const Elf32_Phdr *phdr) {
+    uint32_t vaddr = phdr->p_vaddr;
+    uint32_t page_start = vaddr & ~0xFFF;
+    uint32_t page_end = (vaddr + phdr->p_memsz + 0xFFF) & ~0xFFF;
+    uint32_t data_end = (vaddr + phdr->p_filesz + 0xFFF) & ~0xFFF;
+    uint32_t area_flags = PAGE_USER | ((phdr->p_flags & PF_W) ? PAGE_RW : 0);
+
+    // A fault can't report a truncated file, catch it now
+    uint8_t last;
+    if (phdr->p_filesz > 0 &&
+        vfs_file_pread(file->file, &last, 1, phdr->p_offset + phdr->p_filesz - 1) != 1) {
+        klogf("[elf] Segment data past end of file\n");
+        return -ENOEXEC;
+    }
+
+    if ((phdr->p_filesz > 0 &&
+         vmm_add_file_region(page_start, data_end, area_flags, file,
+                             phdr->p_offset - (vaddr - page_start), vaddr + phdr->p_filesz) < 0) ||
+        elf_add_area(data_end, page_end, area_flags, VMA_ANON) < 0) {
+        klogf("[elf] Failed to record segment areas\n");
+        return -ENOMEM;
+    }
+
+    klogf("[elf] File-backed: 0x%08x -> 0x%08x (offset %u), demand-zero to 0x%08x\n",
+          page_start, data_end, phdr->p_offset - (vaddr - page_start), page_end);
+    return 0;
+}
 
 // Mapping a PT_LOAD segment
-static int elf_load_segment(const uint8_t *data, const Elf32_Phdr *phdr) {
+static int elf_load_segment(vma_file_t *file, const Elf32_Phdr *phdr, bool lazy) {
+    file_t *vfile = file->file;
     uint32_t vaddr  = phdr->p_vaddr;
     uint32_t memsz  = phdr->p_memsz;
     uint32_t filesz = phdr->p_filesz;
@@ -70,99 +159,253 @@ static int elf_load_segment(const uint8_t *data, const Elf32_Phdr *phdr) {
         return 0;
         // Skipping non load segments
 
+    // A segment must not reach into the kernel half
+    if (!vmm_is_user_range(vaddr, memsz) || filesz > memsz) {
+        klogf("[elf] Segment out of user range: 0x%08x (+%u)\n", vaddr, memsz);
+        return -ENOEXEC;
+    }
+
+    // Pages are filled on first touch when the file range lines up with
+    // them: same offset within the page and no page shared with another
+    // segment. Anything else is loaded now.
+    if (lazy && (vaddr & 0xFFF) == (offset & 0xFFF)) {
+        return elf_map_segment_lazy(file, phdr);
+    }
+
     // Allocate + map mem for this segment
     uint32_t page_start = vaddr & ~0xFFF;
     uint32_t page_end   = (vaddr + memsz + 0xFFF) & ~0xFFF;
 
+    // Pages past the file data are pure BSS, leave them to the page fault
+    // handler instead of zeroing frames the program may never touch
+    uint32_t data_end = (vaddr + filesz + 0xFFF) & ~0xFFF;
+    uint32_t area_flags = PAGE_USER | ((phdr->p_flags & PF_W) ? PAGE_RW : 0);
+    if (elf_add_area(page_start, data_end, area_flags, VMA_LOADED) < 0 ||
+        elf_add_area(data_end, page_end, area_flags, VMA_ANON) < 0) {
+        klogf("[elf] Failed to record segment areas\n");
+        return -ENOMEM;
+    }
+
+    if (data_end < page_end) {
+        klogf("[elf] Demand-zero BSS: 0x%08x -> 0x%08x\n", data_end, page_end);
+        page_end = data_end;
+    }
+
     klogf("[elf] Mapping pages: 0x%08x -> 0x%08x\n", page_start, page_end);
 
-    for (uint32_t addr = page_start; addr < page_end; addr += 0x1000) {
-        void *phys = pmm_alloc_frame();
-        if (!phys) {
+    void *frames[ELF_MAP_BATCH];
+    uint32_t addr = page_start;
+
+    while (addr < page_end) {
+        // Segments may share their boundary page, keep what's already there
+        if (vmm_is_mapped(addr)) {
+            addr += 0x1000;
+            continue;
+        }
+
+        // Run of unmapped pages, one PMM call for all of them
+        uint32_t count = 0;
+        while (count < ELF_MAP_BATCH && addr + count * 0x1000 < page_end &&
+               !vmm_is_mapped(addr + count * 0x1000)) {
+            count++;
+        }
+
+        if (pmm_alloc_zeroed_batch(count, frames) < 0) {
             klogf("[elf] Out of physical memory mapping segment!\n");
-            return -1;
+            return -ENOMEM;
         }
 
-        vmm_map_page(addr, (uint32_t)phys, PAGE_PRESENT | PAGE_RW | PAGE_USER);
+        vmm_map_range(addr, frames, count, PAGE_PRESENT | PAGE_RW | PAGE_USER);
+        addr += count * 0x1000;
     }
 
-    // Copy segment data from file into vmem
-    uint8_t *dest = (uint8_t *)vaddr;
-    const uint8_t *src = data + offset;
-
+    // Read the segment straight from the file into its pages
     if (filesz > 0) {
-        klogf("[elf] Copying %u bytes to 0x%08x\n", filesz, vaddr);
-        memcpy(dest, src, filesz);
+        klogf("[elf] Reading %u bytes to 0x%08x\n", filesz, vaddr);
+
+        int n = vfs_file_pread(vfile, (void *)vaddr, filesz, offset);
+        if (n < 0 || (uint32_t)n != filesz) {
+            klogf("[elf] Segment data past end of file (got %d of %u bytes)\n", n, filesz);
+            return -ENOEXEC;
+        }
     }
 
-    // Zero out the BSS
+    // BSS needs no memset, the pages above came pre-zeroed and the rest
+    // is demand-zero
     if (memsz > filesz) {
-        uint32_t bss_size = memsz - filesz;
-        klogf("[elf] Zeroing BSS: %u bytes at 0x%08x\n", bss_size, vaddr + filesz);
-        memset(dest + filesz, 0, bss_size);
+        klogf("[elf] BSS: %u bytes at 0x%08x\n", memsz - filesz, vaddr + filesz);
     }
 
     return 0;
 }
 
-int elf_load(const uint8_t *data, uint32_t size, elf_program_t *out) {
-    if (!data || !out) {
+// Drop write access from [start, end), skipping the pages of writable
+// segments from index `from` onwards. A writable range in the middle
+// splits the range and both sides are protected separately.
+static void elf_protect_range(const Elf32_Phdr *phdr, uint32_t phnum, uint32_t from,
+                              uint32_t start, uint32_t end) {
+    for (uint32_t j = from; j < phnum && start < end; j++) {
+        if (phdr[j].p_type != PT_LOAD || !(phdr[j].p_flags & PF_W) || phdr[j].p_memsz == 0) {
+            continue;
+        }
+
+        uint32_t w_start = phdr[j].p_vaddr & ~0xFFF;
+        uint32_t w_end = (phdr[j].p_vaddr + phdr[j].p_memsz + 0xFFF) & ~0xFFF;
+
+        if (w_start >= end || w_end <= start) {
+            continue;
+        }
+
+        if (w_start > start && w_end < end) {
+            // Recursion depth is bounded by ELF_MAX_PHNUM
+            elf_protect_range(phdr, phnum, j + 1, start, w_start);
+            start = w_end;
+        } else if (w_start <= start) {
+            start = w_end;
+        } else {
+            end = w_start;
+        }
+    }
+
+    if (start < end) {
+        vmm_protect_range(start, (end - start) / 0x1000, PAGE_PRESENT | PAGE_USER);
+    }
+}
+
+// Drop write access from read-only segments once everything is copied in.
+// A page shared with a writable segment stays writable.
+static void elf_protect_segments(const Elf32_Phdr *phdr, uint32_t phnum) {
+    for (uint32_t i = 0; i < phnum; i++) {
+        if (phdr[i].p_type != PT_LOAD || (phdr[i].p_flags & PF_W) || phdr[i].p_memsz == 0) {
+            continue;
+        }
+
+        uint32_t start = phdr[i].p_vaddr & ~0xFFF;
+        uint32_t end = (phdr[i].p_vaddr + phdr[i].p_memsz + 0xFFF) & ~0xFFF;
+        elf_protect_range(phdr, phnum, 0, start, end);
+    }
+}
+
+int elf_load(vma_file_t *file, elf_program_t *out) {
+    if (!file || !out) {
         klogf("[elf] Invalid parameters!\n");
-        return -1;
+        return -EINVAL;
     }
 
-    if (size < sizeof(Elf32_Ehdr)) {
+    // Parse the ELF32 header
+    Elf32_Ehdr ehdr;
+    file_t *vfile = file->file;
+    if (vfs_file_pread(vfile, &ehdr, sizeof(ehdr), 0) != (int)sizeof(ehdr)) {
         klogf("[elf] File too small for ELF header\n");
-        return -1;
+        return -ENOEXEC;
     }
 
-    // Parse the ELF32 header
-    const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)data;
-    if (elf_validate_header(ehdr) < 0) {
-        return -1;
+    int err = elf_validate_header(&ehdr);
+    if (err < 0) {
+        return err;
     }
 
     klogf("[elf] Valid elf32 executable!\n");
-    klogf("[elf] Entry point: 0x%08x\n", ehdr->e_entry);
-    klogf("[elf] Program headers: %u at offset %u\n", ehdr->e_phnum, ehdr->e_phoff);
+    klogf("[elf] Entry point: 0x%08x\n", ehdr.e_entry);
+    klogf("[elf] Program headers: %u at offset %u\n", ehdr.e_phnum, ehdr.e_phoff);
+
+    if (ehdr.e_phentsize != sizeof(Elf32_Phdr) || ehdr.e_phnum > ELF_MAX_PHNUM) {
+        klogf("[elf] Unsupported program header table (%u x %u bytes)\n",
+              ehdr.e_phnum, ehdr.e_phentsize);
+        return -ENOEXEC;
+    }
+
+    // Only the program header table is buffered, segments are read into
+    // place one by one (or on first touch)
+    uint32_t phsize = ehdr.e_phnum * sizeof(Elf32_Phdr);
+    Elf32_Phdr *phdr = kalloc(phsize ? phsize : sizeof(Elf32_Phdr));
+    if (!phdr) {
+        klogf("[elf] Out of memory for program headers\n");
+        return -ENOMEM;
+    }
 
-    // Verify program header table is within bounds
-    if (ehdr->e_phoff + (ehdr->e_phnum * ehdr->e_phentsize) > size) {
+    if (vfs_file_pread(vfile, phdr, phsize, ehdr.e_phoff) != (int)phsize) {
         klogf("[elf] Program headers extend past end of file\n");
-        return -1;
+        kfree(phdr);
+        return -ENOEXEC;
     }
 
-    // Load each PT_LOAD segment (i do not like how this looks)
-    const Elf32_Phdr *phdr = (const Elf32_Phdr *)(data + ehdr->e_phoff);
-    
-    for (int i = 0; i < ehdr->e_phnum; i++) {
-        if (elf_load_segment(data, &phdr[i]) < 0) {
+    for (int i = 0; i < ehdr.e_phnum; i++) {
+        bool lazy = !elf_shares_page(phdr, ehdr.e_phnum, i);
+        err = elf_load_segment(file, &phdr[i], lazy);
+        if (err < 0) {
             klogf("[elf] Failed to load segment %d\n", i);
-            return -1;
+            kfree(phdr);
+            return err;
         }
     }
 
+    elf_protect_segments(phdr, ehdr.e_phnum);
+    kfree(phdr);
+
     // Fill out program info
-    out->entry = ehdr->e_entry;
+    out->entry = ehdr.e_entry;
     
-    // Allocate user stack (conventional location: just below 3GB)
-    // Top of user space - 4KB
-    uint32_t user_stack_virt = 0xBFFFF000;  
-    
-    void *stack_phys = pmm_alloc_frame();
-    if (!stack_phys) {
-        klogf("[elf] Failed to allocate user stack\n");
-        return -1;
+    // Reserve the user stack (conventional location: just below 3GB).
+    // Only the pages it actually grows into get frames.
+    if (vmm_add_region(USER_SPACE_END - ELF_STACK_SIZE, USER_SPACE_END, PAGE_RW | PAGE_USER, VMA_ANON) < 0) {
+        klogf("[elf] Failed to reserve user stack\n");
+        return -ENOMEM;
     }
 
-    vmm_map_page(user_stack_virt, (uint32_t)stack_phys, PAGE_PRESENT | PAGE_RW | PAGE_USER);
-
     // Stack grows down, so point to top (stop forgetting this)
-    out->stack_pointer = user_stack_virt + 0x1000;
+    out->stack_pointer = USER_SPACE_END;
 
     klogf("[elf] User stack at 0x%08x\n", out->stack_pointer);
     klogf("[elf] ELF loaded successfully\n");
 
     return 0;
 
-}
\ No newline at end of file
+}
+
+static uint32_t elf_count_strings(const char *const strs[], uint32_t *bytes) {
+    uint32_t count = 0;
+    if (strs) {
+        for (; strs[count]; count++) {
+            *bytes += strlen(strs[count]) + 1;
+        }
+    }
+    return count;
+}
+
+// Copy strs just below *top, storing where each one landed into slots
+static void elf_push_strings(const char *const strs[], uint32_t count, uint32_t *top, uint32_t *slots) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t len = strlen(strs[i]) + 1;
+        *top -= len;
+        memcpy((void *)*top, strs[i], len);
+        slots[i] = *top;
+    }
+    slots[count] = 0;
+}
+
+int elf_push_args(elf_program_t *prog, const char *const argv[], const char *const envp[]) {
+    uint32_t bytes = 0;
+    uint32_t argc = elf_count_strings(argv, &bytes);
+    uint32_t envc = elf_count_strings(envp, &bytes);
+
+    // argc, argv[], NULL, envp[], NULL
+    uint32_t words = 1 + argc + 1 + envc + 1;
+    if (bytes + words * sizeof(uint32_t) + 16 > ELF_ARGS_MAX) {
+        klogf("[elf] Arguments too large (%u strings, %u bytes)\n", argc + envc, bytes);
+        return -E2BIG;
+    }
+
+    uint32_t top = prog->stack_pointer;
+    uint32_t base = (top - bytes - words * sizeof(uint32_t)) & ~0xF;
+    uint32_t *frame = (uint32_t *)base;
+
+    // The stack is demand-zero, these writes fault its top pages in
+    frame[0] = argc;
+    elf_push_strings(argv, argc, &top, &frame[1]);
+    elf_push_strings(envp, envc, &top, &frame[1 + argc + 1]);
+
+    prog->stack_pointer = base;
+    klogf("[elf] %u args, %u env strings, stack at 0x%08x\n", argc, envc, base);
+    return 0;
+}
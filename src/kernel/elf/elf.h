@@ -21,6 +21,7 @@
 #define HORIZON_ELF_H
 
 #include <stdint.h>
+#include "mm/vma.h"
 
 /** @brief ELF magic number: 0x7F followed by "ELF" */
 #define ELF_MAGIC 0x464C457F
@@ -144,39 +145,62 @@ typedef struct {
 /**
  * @brief Load an ELF binary into memory
  * 
- * Parses an ELF file, validates its format, and loads all PT_LOAD segments
- * into memory at their specified virtual addresses. Sets up BSS (zero-filled
- * uninitialized data) and returns the entry point.
+ * Reads the ELF and program headers from an open file and sets up each
+ * PT_LOAD segment. A segment whose pages line up with its file range
+ * becomes a file area (see vmm_add_file_region()): nothing is read now,
+ * each page is read from the file when first touched, so loading costs
+ * only the pages the program uses. Other segments (sharing a page with
+ * another one, or misaligned in the file) are read directly into pages
+ * mapped at their virtual address right away.
  * 
  * Steps:
  * - 1. Validate ELF magic, class (32-bit), and architecture (x86)
- * - 2. Parse program headers
+ * - 2. Read the program headers
  * - 3. For each PT_LOAD segment:
- *   - Allocate pages at segment's virtual address
- *   - Copy segment data from file
- *   - Zero any BSS (p_memsz > p_filesz)
- *   - Set page permissions based on segment flags
- * - 4. Return entry point and stack pointer
- * 
- * @param data Pointer to ELF file data in memory
- * @param size Size of ELF file in bytes
+ *   - Record its file pages as a file area, or map pages and read the
+ *     segment data into them
+ *   - Leave BSS (p_memsz > p_filesz) zero or demand-zero
+ * - 4. Drop write access from read-only segments
+ * - 5. Reserve the stack, return entry point and stack pointer
+ * 
+ * @param file The ELF file (its offset is not used or changed). File areas
+ *             take references, keeping it open while they exist.
  * @param out Output structure to fill with entry point and stack info
  * 
- * @return 0 on success, -1 on error (invalid ELF, unsupported format, etc.)
+ * @return 0 on success, or a negative errno: -ENOEXEC for an invalid or
+ *         unsupported file, -ENOMEM if out of memory
+ *         (-EINVAL for NULL parameters)
  * 
  * Example:
  * @code
- * uint8_t *elf_data = read_file("/bin/hello");
+ * vma_file_t *file = vma_file_open(vfs_file_open("/bin/hello", 0));
  * elf_program_t prog;
- * if (elf_load(elf_data, file_size, &prog) == 0) {
- *     jump_to_usermode(prog.stack_pointer);
- *     // Jump to prog.entry happens inside jump_to_usermode()
+ * if (elf_load(file, &prog) == 0) {
+ *     // Enter ring 3 at prog.entry with prog.stack_pointer
  * }
+ * vma_file_put(file);
  * @endcode
  * 
  * @note Does not support dynamic linking, relocations, or shared libraries yet
- * @warning Assumes virtual memory is already set up for userspace!
+ * @warning Loads into the current address space!
+ */
+int elf_load(vma_file_t *file, elf_program_t *out);
+
+/**
+ * @brief Build the initial argument frame on a loaded program's stack
+ * 
+ * Lays out the i386 System V process entry stack below
+ * prog->stack_pointer: argc, the argv pointers and a NULL, the envp
+ * pointers and a NULL, with the strings themselves above them. On
+ * return prog->stack_pointer points at argc, 16-byte aligned.
+ * 
+ * Must run in the program's address space, after elf_load().
+ * 
+ * @param prog Program returned by elf_load()
+ * @param argv NULL-terminated argument strings (kernel memory, may be NULL)
+ * @param envp NULL-terminated environment strings (kernel memory, may be NULL)
+ * @return 0 on success, -E2BIG if the arguments don't fit on the stack
  */
-int elf_load(const uint8_t *data, uint32_t size, elf_program_t *out);
+int elf_push_args(elf_program_t *prog, const char *const argv[], const char *const envp[]);
 
 #endif // HORIZON_ELF_H
\ No newline at end of file
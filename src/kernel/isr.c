@@ -3,6 +3,7 @@
 #include "../libk/kprint.h"
 #include "kernel/log.h"
 #include "kernel/pic.h"
+#include "mm/vmm.h"
 #include <stdint.h>
 
 static isr_t interrupt_handlers[256];
@@ -107,6 +108,12 @@ void isr_handler(regs_t* r)
     if (int_no == 14) {  // Page fault specific error
         uint32_t faulting_addr;
         __asm__ volatile("mov %%cr2, %0" : "=r"(faulting_addr));
+
+        // Demand-zero or file-backed page touched for the first time, or
+        // a write to a copy-on-write page
+        if (vmm_handle_fault(faulting_addr, r->err_code) == 0) {
+            return;
+        }
         
         klogf("[exc] PAGE FAULT at EIP=0x%08x\n", r->eip);
         klogf("[exc] Faulting address: 0x%08x\n", faulting_addr);
@@ -33,11 +33,6 @@ extern int dummy_fs_init(void);
 extern void serial_init(void);
 extern void serial_puts(const char *s);
 
-// Kernel heap memory management
-extern void kheap_init(void);
-extern void *kalloc(uint32_t size);
-extern void kfree(void *ptr);
-
 // Userland flag
 bool userland = false;
 
@@ -66,7 +61,7 @@ void display_mb_info(multiboot_info_t *mb) {
     }
 
     if (mb->flags & MB_INFO_CMDLINE) {
-        const char *cmd = (const char *)(uintptr_t)mb->cmdline;
+        const char *cmd = mb->cmdline ? (const char *)PHYS_TO_VIRT(mb->cmdline) : NULL;
         kprintf_both("[mb] Cmdline: %s\n", cmd ? cmd : "(none)");
     }
 
@@ -94,6 +89,8 @@ no_mb_mem_info:
 void test_heap(void) {
     klogf("\n[test] ===== Testing Heap =====\n");
     
+    uint32_t used_before = kheap_get_used();
+
     // Test 1: Small allocation
     void *ptr1 = kalloc(64);
     klogf("[test] kalloc(64) = 0x%08x\n", (uint32_t)ptr1);
@@ -124,6 +121,31 @@ void test_heap(void) {
     klogf("[test] Heap used: %u KB of %u KB\n", 
           kheap_get_used() / 1024, kheap_get_size() / 1024);
     
+    uint32_t size_peak = kheap_get_size();
+
+    // Test 4: A freed block is handed out again. ptr2 sits between two
+    // live blocks, so it stays a hole of its own and is the best fit.
+    kfree(ptr2);
+    void *ptr4 = kalloc(512);
+    klogf("[test] kfree(ptr2), kalloc(512) = 0x%08x (%s)\n",
+          (uint32_t)ptr4, ptr4 == ptr2 ? "reused" : "FAIL: not reused");
+
+    // Test 5: Freeing everything coalesces back into one free block,
+    // gives the pages of the large block back and leaves no bytes in use
+    kfree(ptr1);
+    kfree(ptr4);
+    kfree(ptr3);
+    klogf("[test] Freed all: used %u bytes (%s), size %u KB -> %u KB (%s)\n",
+          kheap_get_used(), kheap_get_used() == used_before ? "ok" : "FAIL: leaked",
+          size_peak / 1024, kheap_get_size() / 1024,
+          kheap_get_size() < size_peak ? "pages returned" : "FAIL: pages kept");
+
+    // Test 6: The merged block starts where the first allocation did
+    void *ptr5 = kalloc(64);
+    klogf("[test] kalloc(64) = 0x%08x (%s)\n",
+          (uint32_t)ptr5, ptr5 == ptr1 ? "coalesced" : "FAIL: not coalesced");
+    kfree(ptr5);
+    
     pmm_dump_stats();
     
     klogf("[test] ===== Heap Test Complete =====\n\n");
@@ -136,7 +158,8 @@ void kmain(uint32_t magic, uint32_t mb_info_addr) {
     if (magic != MULTIBOOT_MAGIC)
         goto not_multiboot;
 
-    multiboot_info_t *mb = (multiboot_info_t *)(uintptr_t)mb_info_addr;
+    // The bootloader hands over a physical address
+    multiboot_info_t *mb = (multiboot_info_t *)PHYS_TO_VIRT(mb_info_addr);
 
     // ========== Phase 1: Basic Hardware & Logging ==========
     
@@ -182,6 +205,13 @@ void kmain(uint32_t magic, uint32_t mb_info_addr) {
     kheap_init();
     klogf("[heap] Kernel heap has been allocated.\n");
     test_heap();
+    kheap_dump_stats();
+
+    kmem_init();
+    klogf("[slab] Slab caches are ready.\n");
+
+    vmalloc_init();
+    image_init();
 
     // ========== Phase 4: Block Devices & Filesystems ==========
     
@@ -259,28 +289,6 @@ void kmain(uint32_t magic, uint32_t mb_info_addr) {
 
     kprintf_both("[ring3] The kernel is now ready for ring3 operations.\n");
 
-    // Allocate user stack
-    void *user_stack_frame = pmm_alloc_frame();
-    if (!user_stack_frame) {
-        kprintf_both("[kernel] Failed to allocate user stack frame!\n");
-        goto bad_kalloc;
-    }
-
-    uint32_t user_stack_phys = (uint32_t)user_stack_frame;
-    uint32_t user_stack_virt = 0x00800000;
-
-    klogf("[ring3] Allocating user stack:\n");
-    klogf("[ring3]   Physical: 0x%08x\n", user_stack_phys);
-    klogf("[ring3]   Virtual:  0x%08x\n", user_stack_virt);
-
-    // Map it as user-accessible
-    vmm_map_page(user_stack_virt, user_stack_phys, PAGE_PRESENT | PAGE_RW | PAGE_USER);
-
-    // Stack grows down, so pass top of page
-    uint32_t user_stack_top = user_stack_virt + 4096;
-
-    klogf("[ring3]   Stack top: 0x%08x\n", user_stack_top);
-
     // ========== Phase 6: Launch Userspace ==========
 
     jump_to_elf("/sbin/init");
@@ -0,0 +1,177 @@
+#include "proc.h"
+#include "kernel/log.h"
+#include "mm/slab.h"
+#include "mm/pmm.h"
+#include "../libk/string.h"
+
+// Segment selectors for ring 3
+#define USER_CS 0x1B
+#define USER_DS 0x23
+
+static kmem_cache_t *proc_cache = NULL;
+static process_t *current = NULL;
+static process_t *run_head = NULL;      // Waiting processes, oldest first
+static process_t *run_tail = NULL;
+static uint32_t next_pid = 1;
+
+static process_t *proc_alloc(address_space_t *space, uint32_t parent_pid) {
+    if (!proc_cache) {
+        proc_cache = kmem_cache_create("process", sizeof(process_t), 0, 0, NULL);
+        if (!proc_cache) {
+            return NULL;
+        }
+    }
+
+    process_t *proc = kmem_cache_alloc(proc_cache);
+    if (!proc) {
+        return NULL;
+    }
+
+    proc->pid = next_pid++;
+    proc->parent_pid = parent_pid;
+    proc->space = space;
+    proc->fds = NULL;
+    proc->heap_start = PROC_HEAP_START;
+    proc->brk = PROC_HEAP_START;
+    proc->next = NULL;
+    return proc;
+}
+
+static void run_queue_push(process_t *proc) {
+    proc->next = NULL;
+    if (run_tail) {
+        run_tail->next = proc;
+    } else {
+        run_head = proc;
+    }
+    run_tail = proc;
+}
+
+static process_t *run_queue_pop(void) {
+    process_t *proc = run_head;
+    if (proc) {
+        run_head = proc->next;
+        if (!run_head) {
+            run_tail = NULL;
+        }
+        proc->next = NULL;
+    }
+    return proc;
+}
+
+process_t *proc_create(address_space_t *space) {
+    process_t *proc = proc_alloc(space, 0);
+    if (!proc) {
+        return NULL;
+    }
+
+    proc->fds = fd_table_create();
+    if (!proc->fds) {
+        kmem_cache_free(proc_cache, proc);
+        return NULL;
+    }
+
+    current = proc;
+    fd_table_switch(proc->fds);
+    klogf("[proc] Started process %u\n", proc->pid);
+    return proc;
+}
+
+process_t *proc_spawn(address_space_t *space, uint32_t entry, uint32_t stack) {
+    process_t *proc = proc_alloc(space, current ? current->pid : 0);
+    if (!proc) {
+        return NULL;
+    }
+
+    proc->fds = current ? fd_table_clone(current->fds) : fd_table_create();
+    if (!proc->fds) {
+        kmem_cache_free(proc_cache, proc);
+        return NULL;
+    }
+
+    // First resumed like any other process, through an iret to ring 3
+    memset(&proc->frame, 0, sizeof(proc->frame));
+    proc->frame.gs = proc->frame.fs = proc->frame.es = proc->frame.ds = USER_DS;
+    proc->frame.eip = entry;
+    proc->frame.cs = USER_CS;
+    proc->frame.eflags = 0x202;     // IF
+    proc->frame.useresp = stack;
+    proc->frame.ss = USER_DS;
+
+    run_queue_push(proc);
+    klogf("[proc] Spawned process %u\n", proc->pid);
+    return proc;
+}
+
+process_t *proc_current(void) {
+    return current;
+}
+
+int32_t proc_fork(regs_t *frame) {
+    if (!current) {
+        return -1;
+    }
+
+    address_space_t *space = vmm_clone_address_space();
+    if (!space) {
+        return -1;
+    }
+
+    process_t *child = proc_alloc(space, current->pid);
+    if (!child) {
+        vmm_destroy_address_space(space);
+        return -1;
+    }
+
+    child->fds = fd_table_clone(current->fds);
+    if (!child->fds) {
+        kmem_cache_free(proc_cache, child);
+        vmm_destroy_address_space(space);
+        return -1;
+    }
+    child->heap_start = current->heap_start;
+    child->brk = current->brk;
+
+    // The parent resumes later with the child's PID as fork's result
+    current->frame = *frame;
+    current->frame.eax = child->pid;
+    run_queue_push(current);
+
+    // The child carries on from the live frame in its own space
+    klogf("[proc] Process %u forked child %u\n", current->pid, child->pid);
+    current = child;
+    vmm_switch(space);
+    fd_table_switch(child->fds);
+    return 0;
+}
+
+int32_t proc_exit(regs_t *frame, uint32_t status) {
+    process_t *proc = current;
+    process_t *next = run_queue_pop();
+
+    klogf("[proc] Process %u exited with code %u\n", proc ? proc->pid : 0, status);
+
+    if (!next) {
+        kprintf_both("Process exited with code %u\n", status);
+        kprintf_both("System halted (nothing left to run)\n");
+
+        for (;;) {
+            if (!pmm_zero_pool_refill()) {
+                __asm__ volatile("hlt");
+            }
+        }
+    }
+
+    current = next;
+    vmm_switch(next->space);
+    fd_table_switch(next->fds);
+    *frame = next->frame;
+
+    if (proc) {
+        fd_table_destroy(proc->fds);
+        vmm_destroy_address_space(proc->space);
+        kmem_cache_free(proc_cache, proc);
+    }
+
+    return (int32_t)frame->eax;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file proc.h
+ * @brief User Processes
+ * 
+ * A process is an address space plus the user registers it was stopped
+ * with, its file descriptors and its program break. Processes only enter
+ * the kernel through interrupts and leave it the same way, so all of them
+ * share the one kernel stack: switching processes means saving the
+ * interrupt frame of the one leaving, loading the frame of the one coming
+ * in and switching address spaces and descriptor tables. The iret at the
+ * end of the interrupt then resumes the new process.
+ * 
+ * There is no preemption yet. The current process runs until it forks
+ * (the child runs first, see proc_fork()) or exits, and waiting
+ * processes (including spawned ones) are resumed in the order they were
+ * queued.
+ */
+
+#ifndef PROC_H
+#define PROC_H
+
+#include <stdint.h>
+#include "kernel/isr.h"
+#include "mm/vmm.h"
+#include "drivers/vfs/file.h"
+
+/** @brief Where the program break of a new image starts */
+#define PROC_HEAP_START 0x40000000
+
+/** @brief A user process */
+typedef struct process {
+    uint32_t pid;
+    uint32_t parent_pid;        /**< 0 for the first process */
+    address_space_t *space;
+    fd_table_t *fds;            /**< Its descriptors, current while it runs */
+    uint32_t heap_start;        /**< Lowest break brk() accepts */
+    uint32_t brk;               /**< Current program break */
+    regs_t frame;               /**< User registers while not running */
+    struct process *next;       /**< Run queue link */
+} process_t;
+
+/**
+ * @brief Make a process around an address space and run it
+ * 
+ * Used for the first process. It becomes the current one, with no open
+ * descriptors and the break at PROC_HEAP_START; the caller enters user
+ * mode itself.
+ * 
+ * @param space Address space of the process (already switched to)
+ * @return The process, or NULL if out of memory
+ */
+process_t *proc_create(address_space_t *space);
+
+/**
+ * @brief Queue a new process
+ * 
+ * The process starts in user mode at entry with the given stack once it
+ * gets its turn. Its parent is the running process, whose descriptors it
+ * inherits. The break starts at PROC_HEAP_START.
+ * 
+ * @param space Address space with the program loaded
+ * @param entry User entry point
+ * @param stack Initial user stack pointer
+ * @return The process, or NULL if out of memory
+ */
+process_t *proc_spawn(address_space_t *space, uint32_t entry, uint32_t stack);
+
+/**
+ * @brief Get the running process
+ * 
+ * @return The process, or NULL before the first one is created
+ */
+process_t *proc_current(void);
+
+/**
+ * @brief Fork the running process
+ * 
+ * The child gets a copy-on-write clone of the address space (see
+ * vmm_clone_address_space()), a copy of the descriptor table (see
+ * fd_table_clone()), the parent's break and the parent's registers. It
+ * runs first: the parent is queued with the child's PID as its syscall
+ * result and frame is loaded with the child's registers. A fork followed by exec
+ * replaces the child's image before the parent writes to anything, so
+ * the parent keeps its frames without copying them.
+ * 
+ * @param frame Interrupt frame of the running process
+ * @return 0 (the child's result) on success, -1 if out of memory
+ */
+int32_t proc_fork(regs_t *frame);
+
+/**
+ * @brief End the running process and resume the next one
+ * 
+ * Frees the process, its address space and descriptors (closing files no
+ * one else has open), then loads the next queued process into frame.
+ * Does not return if there is nothing left to run.
+ * 
+ * @param frame Interrupt frame of the running process
+ * @param status Exit status
+ * @return Syscall result to hand the resumed process
+ */
+int32_t proc_exit(regs_t *frame, uint32_t status);
+
+#endif // PROC_H
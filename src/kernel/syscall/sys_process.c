@@ -11,8 +11,17 @@
 #include "../../drivers/keyboard/keyboard.h"
 
 #include "mm/mm.h"
+#include "kernel/proc.h"
+#include "kernel/usermode.h"
+#include "../../libk/string.h"
+#include "syscall.h"
 #include "sys_process.h"
 
+// Longest path and argument list accepted from user space
+#define USER_PATH_MAX   256
+#define USER_ARGV_MAX   64
+#define SPAWN_STRINGS_MAX 4096  // Path, argv and envp strings together
+
 // ----------------------------------------------------------------------------
 // SYS_EXIT (1)
 // ----------------------------------------------------------------------------
@@ -20,23 +29,9 @@ int32_t sys_exit(uint32_t status, uint32_t u2, uint32_t u3,
                  uint32_t u4, uint32_t u5, uint32_t u6) {
     (void)u2; (void)u3; (void)u4; (void)u5; (void)u6;
 
-    klogf("[proc] Process exited with code %u\n", status);
-
-    // TODO (when you have real processes):
-    // - close fds
-    // - free address space
-    // - free kernel resources
-    // - schedule next runnable task
-
-    kprintf_both("Process exited with code %u\n", status);
-    kprintf_both("System halted (no scheduler yet)\n");
-
-    for (;;) {
-        __asm__ volatile("hlt");
-    }
-
-    // Unreachable
-    return 0;
+    // Resumes the next process in the caller's place, the result is the
+    // one that process is waiting for
+    return proc_exit(syscall_frame(), status);
 }
 
 // ----------------------------------------------------------------------------
@@ -46,8 +41,8 @@ int32_t sys_getpid(uint32_t u1, uint32_t u2, uint32_t u3,
                    uint32_t u4, uint32_t u5, uint32_t u6) {
     (void)u1; (void)u2; (void)u3; (void)u4; (void)u5; (void)u6;
 
-    // Single "process" environment for now.
-    return 1;
+    process_t *proc = proc_current();
+    return proc ? (int32_t)proc->pid : 1;
 }
 
 // ----------------------------------------------------------------------------
@@ -62,6 +57,11 @@ int32_t sys_write(uint32_t fd, uint32_t buf, uint32_t count,
         return SYSCALL_ERR(EFAULT);
     }
 
+    if (!vmm_check_user(buf, count, false)) {
+        klogf("[syscall] write: bad buffer 0x%x (+%u)\n", buf, count);
+        return SYSCALL_ERR(EFAULT);
+    }
+
     const char *str = (const char *)buf;
 
     // stdout/stderr -> VGA + serial
@@ -97,6 +97,11 @@ int32_t sys_read(uint32_t fd, uint32_t buf, uint32_t count,
         return 0;
     }
 
+    if (!vmm_check_user(buf, count, true)) {
+        klogf("[syscall] read: bad buffer 0x%x (+%u)\n", buf, count);
+        return SYSCALL_ERR(EFAULT);
+    }
+
     char *out = (char *)buf;
 
     // stdin -> keyboard stream
@@ -110,7 +115,11 @@ int32_t sys_read(uint32_t fd, uint32_t buf, uint32_t count,
                 out[i++] = (char)ch;
                 break;
             }
-            __asm__ volatile("hlt");
+
+            // Spend the wait zeroing frames for later
+            if (!pmm_zero_pool_refill()) {
+                __asm__ volatile("hlt");
+            }
         }
 
         // Drain any additional available bytes (non-blocking)
@@ -151,6 +160,11 @@ int32_t sys_open(uint32_t pathname, uint32_t flags, uint32_t mode,
         return SYSCALL_ERR(EFAULT);
     }
 
+    if (vmm_user_strlen(pathname, USER_PATH_MAX) < 0) {
+        klogf("[syscall] open: bad pathname 0x%x\n", pathname);
+        return SYSCALL_ERR(EFAULT);
+    }
+
     const char *path = (const char *)pathname;
 
     int fd = vfs_open((char *)path, (int)flags);
@@ -187,14 +201,19 @@ int32_t sys_close(uint32_t fd, uint32_t u2, uint32_t u3,
 }
 
 // ----------------------------------------------------------------------------
-// SYS_FORK (2) - stub
+// SYS_FORK (2)
 // ----------------------------------------------------------------------------
 int32_t sys_fork(uint32_t u1, uint32_t u2, uint32_t u3,
                  uint32_t u4, uint32_t u5, uint32_t u6) {
     (void)u1; (void)u2; (void)u3; (void)u4; (void)u5; (void)u6;
 
-    klogf("[syscall] fork: stub (need scheduler/process model)\n");
-    return SYSCALL_ERR(EAGAIN);
+    // Returns in the child, the parent gets the child's PID when resumed
+    if (proc_fork(syscall_frame()) < 0) {
+        klogf("[syscall] fork: out of memory\n");
+        return SYSCALL_ERR(ENOMEM);
+    }
+
+    return 0;
 }
 
 // ----------------------------------------------------------------------------
@@ -209,6 +228,11 @@ int32_t sys_execve(uint32_t filename, uint32_t argv, uint32_t envp,
         return SYSCALL_ERR(EFAULT);
     }
 
+    if (vmm_user_strlen(filename, USER_PATH_MAX) < 0) {
+        klogf("[syscall] execve: bad filename 0x%x\n", filename);
+        return SYSCALL_ERR(EFAULT);
+    }
+
     const char *path = (const char *)filename;
     char **args = (char **)argv;
     (void)envp; // avoid unused warning until you use it
@@ -217,7 +241,16 @@ int32_t sys_execve(uint32_t filename, uint32_t argv, uint32_t envp,
 
     if (args != NULL) {
         klogf("[syscall] execve: argv:\n");
-        for (int i = 0; args[i] != NULL; i++) {
+        for (int i = 0; i < USER_ARGV_MAX; i++) {
+            if (!vmm_check_user((uint32_t)&args[i], sizeof(char *), false)) {
+                return SYSCALL_ERR(EFAULT);
+            }
+            if (args[i] == NULL) {
+                break;
+            }
+            if (vmm_user_strlen((uint32_t)args[i], USER_PATH_MAX) < 0) {
+                return SYSCALL_ERR(EFAULT);
+            }
             klogf("  [%d] = '%s'\n", i, args[i]);
         }
     }
@@ -233,66 +266,47 @@ int32_t sys_brk(uint32_t addr, uint32_t u2, uint32_t u3,
                 uint32_t u4, uint32_t u5, uint32_t u6) {
     (void)u2; (void)u3; (void)u4; (void)u5; (void)u6;
 
-    static uint32_t heap_start = 0;
-    static uint32_t current_brk = 0;
-
-    if (current_brk == 0) {
-        heap_start = 0x40000000;
-        current_brk = heap_start;
-        klogf("[brk] Initialized heap at 0x%x\n", heap_start);
+    // Every process has its own break, moved only in its own areas
+    process_t *proc = proc_current();
+    if (!proc) {
+        return SYSCALL_ERR(ENOMEM);
     }
 
     // Query current brk
     if (addr == 0) {
-        return (int32_t)current_brk;
+        return (int32_t)proc->brk;
     }
 
     // Linux-ish: reject below heap start by returning current brk.
-    if (addr < heap_start) {
+    if (addr < proc->heap_start) {
         klogf("[brk] Request 0x%x below heap start\n", addr);
-        return (int32_t)current_brk;
+        return (int32_t)proc->brk;
     }
 
-    uint32_t old_aligned = (current_brk + 0xFFF) & ~0xFFF;
+    uint32_t old_aligned = (proc->brk + 0xFFF) & ~0xFFF;
     uint32_t new_aligned = (addr + 0xFFF) & ~0xFFF;
 
+    // The heap is demand-zero: growing only reserves the range, frames
+    // are allocated by the page fault handler as pages get touched
     if (new_aligned > old_aligned) {
         uint32_t num_pages = (new_aligned - old_aligned) / 0x1000;
         klogf("[brk] Growing heap by %u pages\n", num_pages);
 
-        for (uint32_t i = 0; i < num_pages; i++) {
-            uint32_t vaddr = old_aligned + (i * 0x1000);
-            void *phys = pmm_alloc_frame();
-            if (!phys) {
-                klogf("[brk] Out of memory while growing heap\n");
-                return (int32_t)current_brk;
-            }
-
-            vmm_map_page(vaddr, (uint32_t)phys, PAGE_PRESENT | PAGE_USER | PAGE_RW);
+        if (vmm_add_region(old_aligned, new_aligned, PAGE_USER | PAGE_RW, VMA_ANON) < 0) {
+            klogf("[brk] Can't reserve 0x%x - 0x%x\n", old_aligned, new_aligned);
+            return (int32_t)proc->brk;
         }
     } else if (new_aligned < old_aligned) {
         uint32_t num_pages = (old_aligned - new_aligned) / 0x1000;
         klogf("[brk] Shrinking heap by %u pages\n", num_pages);
 
-        for (uint32_t i = 0; i < num_pages; i++) {
-            uint32_t vaddr = new_aligned + (i * 0x1000);
-            uint32_t phys = vmm_get_physical(vaddr);
-            if (phys) {
-                pmm_mark_free(phys);
-            }
-            vmm_unmap_page(vaddr);
+        if (vmm_remove_region(new_aligned, old_aligned) < 0) {
+            return (int32_t)proc->brk;
         }
-
-        // Flush TLB
-        __asm__ volatile(
-            "mov %%cr3, %%eax;"
-            "mov %%eax, %%cr3;"
-            : : : "eax"
-        );
     }
 
-    current_brk = addr;
-    return (int32_t)current_brk;
+    proc->brk = addr;
+    return (int32_t)proc->brk;
 }
 
 // ----------------------------------------------------------------------------
@@ -315,3 +329,112 @@ int32_t sys_clear_vga(uint32_t a, uint32_t b, uint32_t c,
     vga_clear();
     return 0;
 }
+
+// ----------------------------------------------------------------------------
+// Horizon syscall: SPAWN (501)
+// ----------------------------------------------------------------------------
+
+// Copy a user string to *pos and point *out at the copy. 0 on success,
+// -EFAULT if it can't be read, -E2BIG if it's longer than max or what
+// is left.
+static int spawn_copy_string(uint32_t addr, uint32_t max, char **pos, char *end,
+                             const char **out) {
+    uint32_t room = (uint32_t)(end - *pos);
+    uint32_t limit = (max < room) ? max : room;
+    int32_t len = vmm_user_strlen(addr, limit);
+    if (len < 0) {
+        // No NUL in limit readable bytes means too long, else a bad pointer
+        return vmm_check_user(addr, limit, false) ? -E2BIG : -EFAULT;
+    }
+    if ((uint32_t)len + 1 > room) {
+        return -E2BIG;
+    }
+
+    char *str = *pos;
+    memcpy(str, (const char *)addr, len + 1);
+    *pos += len + 1;
+    *out = str;
+    return 0;
+}
+
+// Copy a user argv/envp style array, out gets the copies and a NULL.
+// 0 on success, -EFAULT or -E2BIG like spawn_copy_string().
+static int spawn_copy_vector(uint32_t vec, const char **out, char **pos, char *end) {
+    uint32_t n = 0;
+
+    while (vec) {
+        uint32_t slot = vec + n * sizeof(uint32_t);
+        if (n == USER_ARGV_MAX) {
+            return -E2BIG;
+        }
+        if (!vmm_check_user(slot, sizeof(uint32_t), false)) {
+            return -EFAULT;
+        }
+
+        uint32_t addr = *(const uint32_t *)slot;
+        if (!addr) {
+            break;
+        }
+
+        int err = spawn_copy_string(addr, SPAWN_STRINGS_MAX, pos, end, &out[n]);
+        if (err < 0) {
+            return err;
+        }
+        n++;
+    }
+
+    out[n] = NULL;
+    return 0;
+}
+
+int32_t sys_spawn(uint32_t pathname, uint32_t argv, uint32_t envp,
+                  uint32_t u4, uint32_t u5, uint32_t u6) {
+    (void)u4; (void)u5; (void)u6;
+
+    // Everything is copied out of the caller first; the caller's address
+    // space is only read, all the work happens in the new one
+    char *strings = kalloc(SPAWN_STRINGS_MAX);
+    if (!strings) {
+        return SYSCALL_ERR(ENOMEM);
+    }
+
+    char *pos = strings;
+    char *end = strings + SPAWN_STRINGS_MAX;
+    const char *kargv[USER_ARGV_MAX + 1];
+    const char *kenvp[USER_ARGV_MAX + 1];
+
+    const char *path = NULL;
+    int err = spawn_copy_string(pathname, USER_PATH_MAX, &pos, end, &path);
+    if (err == -E2BIG) {
+        err = -ENAMETOOLONG;
+    }
+    if (err == 0) {
+        err = spawn_copy_vector(argv, kargv, &pos, end);
+    }
+    if (err == 0) {
+        err = spawn_copy_vector(envp, kenvp, &pos, end);
+    }
+    if (err < 0) {
+        klogf("[syscall] spawn: bad or oversized arguments (error %d)\n", -err);
+        kfree(strings);
+        return err;
+    }
+
+    // Loader errors are already errnos: ENOENT, ENOEXEC, ENOMEM or E2BIG
+    elf_program_t prog;
+    address_space_t *space;
+    err = usermode_load_elf(path, kargv, kenvp, &prog, &space);
+    kfree(strings);
+
+    if (err < 0) {
+        return err;
+    }
+
+    process_t *proc = proc_spawn(space, prog.entry, prog.stack_pointer);
+    if (!proc) {
+        vmm_destroy_address_space(space);
+        return SYSCALL_ERR(ENOMEM);
+    }
+
+    return (int32_t)proc->pid;
+}
@@ -67,7 +67,8 @@ typedef int32_t (*syscall_impl_t)(
  * @brief SYS_EXIT (1): Terminate the calling process.
  *
  * Linux semantics: exit() does not return.
- * Horizon currently has no scheduler; this halts the system.
+ * Horizon resumes the next waiting process (e.g. the parent of a forked
+ * child) and halts once nothing is left to run.
  *
  * @param status Exit code (low 8 bits typically used by shells).
  * @return Never returns; if it does, returns -ENOSYS / or 0 by convention.
@@ -77,7 +78,7 @@ SYSCALL(sys_exit);
 /**
  * @brief SYS_GETPID (20): Get process ID.
  *
- * Horizon currently returns PID 1 (single "process").
+ * PID of the running process (1 for init).
  *
  * @return PID on success.
  */
@@ -137,11 +138,12 @@ SYSCALL(sys_close);
 /**
  * @brief SYS_FORK (2): Create a child process.
  *
- * Stub until scheduler / process model is implemented.
+ * The child shares the parent's frames copy-on-write and runs first; the
+ * parent is resumed once the child exits.
  *
  * Linux semantics: returns 0 in child, child's PID in parent, -errno on failure.
  *
- * @return -EAGAIN (stub) or proper fork result later.
+ * @return 0 in the child, child's PID in the parent, -ENOMEM on failure.
  */
 SYSCALL(sys_fork);
 
@@ -198,6 +200,24 @@ SYSCALL(sys_alarm);
  */
 SYSCALL(sys_clear_vga);
 
+/**
+ * @brief Horizon syscall: start a program as a new process.
+ *
+ * Loads the executable into a fresh address space with its own argv/envp
+ * and queues it, without copying or touching the caller's address space,
+ * so the cost doesn't depend on the caller's size. The new process runs
+ * once the caller exits or forks.
+ *
+ * @param pathname User pointer to the executable's path.
+ * @param argv     User pointer to argv array (char*[]), NULL-terminated, may be NULL.
+ * @param envp     User pointer to envp array (char*[]), NULL-terminated, may be NULL.
+ * @return PID of the new process, or -errno: -EFAULT for a bad pointer,
+ *         -ENAMETOOLONG for an over-long path, -E2BIG for too many or too
+ *         long arguments, -ENOENT if the file can't be opened, -ENOEXEC if
+ *         it isn't a valid executable, -ENOMEM if out of memory.
+ */
+SYSCALL(sys_spawn);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stddef.h>
 #include "syscall.h"
 #include "kernel/idt.h"
 #include "kernel/isr.h"
@@ -9,6 +10,7 @@
 extern void isr_syscall_stub(void);
 
 static syscall_t syscalls[MAX_SYSCALLS];
+static regs_t *current_frame = NULL;
 
 void syscall_register(uint32_t num, syscall_t func) {
     if (num >= MAX_SYSCALLS)
@@ -30,6 +32,7 @@ void syscall_register_all(void) {
     syscall_register(SYS_BRK,       sys_brk);
     syscall_register(SYS_ALARM,     sys_alarm);
     syscall_register(SYS_CLEAR_VGA, sys_clear_vga);
+    syscall_register(SYS_SPAWN,     sys_spawn);
 }
 
 void syscall_init(void) {
@@ -46,9 +49,15 @@ void syscall_handler(regs_t *r) {
         return;
     }
 
+    current_frame = r;
     int32_t ret = syscalls[num](
         r->ebx, r->ecx, r->edx, r->esi, r->edi, r->ebp
     );
+    current_frame = NULL;
 
     r->eax = ret;
 }
+
+regs_t *syscall_frame(void) {
+    return current_frame;
+}
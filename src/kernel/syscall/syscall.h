@@ -34,7 +34,7 @@
 /** @brief Terminate process */
 #define SYS_EXIT    1
 
-/** @brief Create child process (not implemented yet) */
+/** @brief Create child process */
 #define SYS_FORK    2
 
 /** @brief Read from file descriptor */
@@ -64,6 +64,9 @@
 /** @brief Clears VGA memory (HorizonOS specific) */
 #define SYS_CLEAR_VGA 500
 
+/** @brief Start a program as a new process (HorizonOS specific) */
+#define SYS_SPAWN   501
+
 /**
  * @brief Syscall handler function type
  * 
@@ -130,7 +133,8 @@ void syscall_register(uint32_t num, syscall_t func);
  * 
  * Currently registers:
  * - sys_exit, sys_write, sys_read, sys_open, sys_close
- * - sys_getpid, sys_brk, sys_fork (stub), sys_execve (stub), sys_alarm (stub)
+ * - sys_getpid, sys_brk, sys_fork, sys_execve (stub), sys_alarm (stub)
+ * - sys_clear_vga, sys_spawn
  * 
  * @note Add new syscalls here as they're implemented
  */
@@ -151,4 +155,16 @@ void syscall_register_all(void);
  */
 void syscall_handler(regs_t *r);
 
+/**
+ * @brief Get the interrupt frame of the syscall being handled
+ * 
+ * For syscalls that need more than their arguments, like fork (which
+ * copies the caller's registers) and exit (which replaces them with the
+ * next process's). Changes to the frame take effect when the syscall
+ * returns, except EAX, which is set to the syscall's return value.
+ * 
+ * @return The frame, or NULL outside of a syscall
+ */
+regs_t *syscall_frame(void);
+
 #endif // SYSCALL_H
\ No newline at end of file
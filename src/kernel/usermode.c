@@ -1,6 +1,8 @@
 #include "../libk/string.h"
 #include "kernel/usermode.h"
+#include "kernel/proc.h"
 #include "kernel/log.h"
+#include "kernel/errno.h"
 #include "kernel/panic.h"
 #include "mm/heap.h"
 #include "mm/pmm.h"
@@ -12,58 +14,78 @@ void usermode_entry(void);
 
 #define USER_CODE_SIZE 4096
 
-void jump_to_elf(const char *path) {
+int usermode_load_elf(const char *path, const char *const argv[], const char *const envp[],
+                      elf_program_t *prog, address_space_t **space_out) {
     klogf("\n[elf] === Loading ELF Binary ===\n");
     klogf("[elf] Path: %s\n", path);
     
-    // Open file via VFS
-    int fd = vfs_open(path, 0);  // flags = 0 (read-only)
-    if (fd < 0) {
-        klogf("[elf] Failed to open %s (fd=%d)\n", path, fd);
-        panicf("ELF LOAD FAILED (VFS)");
+    // Open file via VFS. It gets no descriptor, the program can't close
+    // or read it from under its own areas.
+    file_t *vfile = vfs_file_open(path, 0);  // flags = 0 (read-only)
+    if (!vfile) {
+        klogf("[elf] Failed to open %s\n", path);
+        return -ENOENT;
+    }
+
+    // Areas mapping the file keep it open, the last one closes it
+    vma_file_t *file = vma_file_open(vfile);
+    if (!file) {
+        vfs_file_close(vfile);
+        return -ENOMEM;
     }
 
-    // Get file size via stat
+    // Text pages are shared with everyone else running this file. Without
+    // an image every process just reads its own.
     stat_t st;
-    if (vfs_stat(path, &st) < 0) {
-        klogf("[elf] Failed to stat %s\n", path);
-        vfs_close(fd);
-        panicf("ELF LOAD FAILED (STAT_T)");
+    if (vfs_stat(path, &st) == 0) {
+        file->image = image_get(st.dev, st.inode, st.size);
     }
 
-    uint32_t file_size = st.size;
-    klogf("[elf] File size: %u bytes\n", file_size);
+    // Give the program its own user half
+    address_space_t *space = vmm_create_address_space();
+    if (!space) {
+        klogf("[elf] Failed to create address space for %s\n", path);
+        vma_file_put(file);
+        return -ENOMEM;
+    }
+
+    address_space_t *caller = vmm_current_space();
+    vmm_switch(space);
 
-    // Allocate buffer for file
-    uint8_t *data = (uint8_t *)kalloc(file_size);
-    if (!data) {
-        klogf("[elf] Failed to allocate %u bytes for %s\n", file_size, path);
-        vfs_close(fd);
-        panicf("ELF LOAD FAILED (BUFFER ALLOC)");
+    // Segments are read from the file as their pages get touched
+    int result = elf_load(file, prog);
+    if (result == 0) {
+        result = elf_push_args(prog, argv, envp);
     }
 
-    // Read entire file
-    int bytes_read = vfs_read(fd, data, file_size);
-    if (bytes_read < 0 || (uint32_t)bytes_read != file_size) {
-        klogf("[elf] Failed to read %s (got %d bytes)\n", path, bytes_read);
-        kfree(data);
-        vfs_close(fd);
-        panicf("ELF LOAD FAILED (FILE READ)");
+    vma_file_put(file);
+    vmm_switch(caller);
+
+    if (result < 0) {
+        klogf("[elf] Failed to load %s (error %d)\n", path, -result);
+        vmm_destroy_address_space(space);
+        return result;
     }
 
-    vfs_close(fd);
-    
-    klogf("[elf] Read %u bytes successfully\n", file_size);
+    *space_out = space;
+    return 0;
+}
+
+void jump_to_elf(const char *path) {
+    const char *argv[] = { path, NULL };
 
-    // Load ELF
     elf_program_t prog;
-    if (elf_load(data, file_size, &prog) < 0) {
-        klogf("[elf] Failed to load ELF\n");
-        kfree(data);
-        panicf("ELF LOAD FAILED (ELF_PROGRAM_T)");
+    address_space_t *space;
+    if (usermode_load_elf(path, argv, NULL, &prog, &space) < 0) {
+        panicf("ELF LOAD FAILED");
     }
 
-    kfree(data);  // Don't need file buffer anymore
+    vmm_switch(space);
+
+    if (!proc_create(space)) {
+        vmm_destroy_address_space(space);
+        panicf("ELF LOAD FAILED (PROCESS)");
+    }
 
     klogf("[elf] Jumping to entry point: 0x%08x\n", prog.entry);
     klogf("[elf] Stack: 0x%08x\n", prog.stack_pointer);
@@ -110,8 +132,8 @@ void jump_to_usermode(uint32_t user_stack) {
         for(;;);
     }
     
-    // Step 2: Choose a virtual address in user space (0x400000 is conventional)
-    uint32_t user_code_virt = 0x00400000;
+    // Step 2: Choose a virtual address in user space (lowest mappable page)
+    uint32_t user_code_virt = USER_SPACE_START;
 
     klogf("[r3] Allocated user code frame at phys: 0x%08x\n", user_code_phys);
     klogf("[r3] Mapping to virtual address: 0x%08x\n", user_code_virt);
@@ -22,6 +22,8 @@
 #define USERMODE_H
 
 #include <stdint.h>
+#include "mm/vmm.h"
+#include "kernel/elf/elf.h"
 
 /**
  * @brief Jump to user mode with specified stack
@@ -43,6 +45,25 @@
  */
 void jump_to_usermode(uint32_t user_stack);
 
+/**
+ * @brief Load an ELF executable into a new address space
+ * 
+ * Reads the file, loads it into a fresh address space and builds its
+ * argument frame (see elf_push_args()). Only the new space is written;
+ * the caller's address space is current again on return.
+ * 
+ * @param path VFS path to ELF executable
+ * @param argv NULL-terminated arguments (kernel memory, may be NULL)
+ * @param envp NULL-terminated environment (kernel memory, may be NULL)
+ * @param prog Filled with the entry point and initial stack pointer
+ * @param space Receives the new address space on success
+ * @return 0 on success, or a negative errno: -ENOENT if the file can't be
+ *         opened, -ENOEXEC if it's not a valid executable, -ENOMEM if out
+ *         of memory, -E2BIG if the arguments don't fit
+ */
+int usermode_load_elf(const char *path, const char *const argv[], const char *const envp[],
+                      elf_program_t *prog, address_space_t **space);
+
 /**
  * @brief Load and execute an ELF binary in user mode
  * 
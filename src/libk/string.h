@@ -84,6 +84,16 @@ char *strncpy(char *dest, const char *src, size_t n);
  */
 void *memcpy(void *dest, const void *src, size_t n);
 
+/**
+ * @brief Copy memory between possibly overlapping regions
+ * 
+ * Copies n bytes from src to dest as if through a temporary buffer.
+ * 
+ * @param dest Destination pointer
+ * @param src Source pointer
+ * @param n Number of bytes to copy
+ * @return Pointer to dest
+ */
 void *memmove(void *dest, const void *src, size_t n);
 
 /**
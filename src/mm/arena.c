@@ -0,0 +1,99 @@
+#include "arena.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "kernel/log.h"
+
+// Chunks are buddy blocks from the direct mapped zone with a small
+// header in front. They are linked in the order the arena bumps through
+// them; after a reset the bump pointer walks the same chunks again, and a
+// new chunk is only allocated when none of the following ones can hold a
+// request.
+#define ARENA_ALIGN      16
+#define ARENA_MIN_ORDER  1      // Smallest chunk: 8KB
+
+struct arena_chunk {
+    arena_chunk_t *next;
+    uint32_t size;              // Chunk size in bytes, header included
+    uint32_t order;
+};
+
+#define CHUNK_HEADER ((sizeof(arena_chunk_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+static arena_chunk_t *chunk_create(arena_t *arena, uint32_t size) {
+    uint32_t order = ARENA_MIN_ORDER;
+    while (((uint32_t)FRAME_SIZE << order) < CHUNK_HEADER + size) {
+        if (++order > PMM_MAX_ORDER) {
+            klogf("[arena] ERROR: %s: %u bytes is too large\n", arena->name, size);
+            return NULL;
+        }
+    }
+
+    void *phys = pmm_alloc_frames_zone(order, PMM_ZONE_DIRECT);
+    if (!phys) {
+        klogf("[arena] ERROR: %s: Out of memory\n", arena->name);
+        return NULL;
+    }
+
+    arena_chunk_t *chunk = (arena_chunk_t*)PHYS_TO_VIRT(phys);
+
+    chunk->size = (uint32_t)FRAME_SIZE << order;
+    chunk->order = order;
+    arena->bytes += chunk->size;
+    return chunk;
+}
+
+arena_mark_t arena_begin(arena_t *arena) {
+    arena_mark_t mark = { arena->current, arena->offset };
+    return mark;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    arena_chunk_t *chunk = arena->current;
+    if (chunk && arena->offset + size <= chunk->size) {
+        void *ptr = (uint8_t*)chunk + arena->offset;
+        arena->offset += size;
+        return ptr;
+    }
+
+    // Move on to the first following chunk that fits
+    arena_chunk_t **link = chunk ? &chunk->next : &arena->chunks;
+    for (chunk = *link; chunk; chunk = chunk->next) {
+        if (CHUNK_HEADER + size <= chunk->size) {
+            break;
+        }
+    }
+
+    if (!chunk) {
+        chunk = chunk_create(arena, size);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->next = *link;
+        *link = chunk;
+    }
+
+    arena->current = chunk;
+    arena->offset = CHUNK_HEADER + size;
+    return (uint8_t*)chunk + CHUNK_HEADER;
+}
+
+void arena_reset(arena_t *arena, arena_mark_t mark) {
+    arena->current = mark.chunk;
+    arena->offset = mark.offset;
+}
+
+void arena_release(arena_t *arena) {
+    arena_chunk_t *chunk = arena->chunks;
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+        pmm_free_frames((void*)VIRT_TO_PHYS(chunk), chunk->order);
+        chunk = next;
+    }
+
+    arena->chunks = NULL;
+    arena->current = NULL;
+    arena->offset = 0;
+    arena->bytes = 0;
+}
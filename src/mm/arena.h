@@ -0,0 +1,94 @@
+/**
+ * @file arena.h
+ * @brief Scratch Arenas
+ *
+ * Bump allocator for short-lived buffers that belong to one operation
+ * (a path lookup, a file read, loading an executable). Instead of freeing
+ * buffers one by one, code takes a mark with arena_begin(), allocates
+ * freely with arena_alloc() and drops everything allocated since the mark
+ * with arena_reset(). Marks nest, so a helper can open its own scope inside
+ * its caller's.
+ *
+ * An arena keeps the chunks it has grown into across resets, so a context
+ * that repeats the same kind of operation stops touching the PMM once it
+ * has warmed up. Chunks come from the direct mapped zone.
+ *
+ * Example:
+ * @code
+ * arena_mark_t mark = arena_begin(&scratch);
+ * uint8_t *buf = arena_alloc(&scratch, block_size);
+ * ...
+ * arena_reset(&scratch, mark);
+ * @endcode
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct arena_chunk arena_chunk_t;
+
+/**
+ * @brief Scratch arena
+ *
+ * Zero-initialize or use ARENA_INIT(); no other setup is needed.
+ */
+typedef struct {
+    const char *name;           /**< Name used in log messages */
+    arena_chunk_t *chunks;      /**< Chunks in allocation order */
+    arena_chunk_t *current;     /**< Chunk being bumped (NULL = none yet) */
+    uint32_t offset;            /**< Next free byte in current */
+    uint32_t bytes;             /**< Bytes of chunks held */
+} arena_t;
+
+/** @brief Position in an arena, see arena_begin() */
+typedef struct {
+    arena_chunk_t *chunk;
+    uint32_t offset;
+} arena_mark_t;
+
+/** @brief Static initializer for an empty arena */
+#define ARENA_INIT(n) { .name = (n) }
+
+/**
+ * @brief Open a scope in an arena
+ *
+ * @param arena Arena
+ * @return Mark to pass to arena_reset() when the scope ends
+ */
+arena_mark_t arena_begin(arena_t *arena);
+
+/**
+ * @brief Allocate scratch memory
+ *
+ * The memory is 16-byte aligned and not cleared. It stays valid until
+ * the arena is reset to a mark taken before this call.
+ *
+ * @param arena Arena
+ * @param size Bytes to allocate
+ * @return Memory, or NULL if out of memory
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * @brief Free everything allocated since a mark
+ *
+ * The arena keeps its chunks for later allocations.
+ *
+ * @param arena Arena
+ * @param mark Mark from arena_begin()
+ */
+void arena_reset(arena_t *arena, arena_mark_t mark);
+
+/**
+ * @brief Return all of an arena's chunks to the PMM
+ *
+ * Invalidates every allocation and mark. The arena can be used again.
+ *
+ * @param arena Arena
+ */
+void arena_release(arena_t *arena);
+
+#endif // ARENA_H
@@ -1,79 +1,529 @@
 #include "heap.h"
 #include "kernel/log.h"
+#include "pmm.h"
 #include "vmm.h"
+#include "../libk/string.h"
 
 // Heap configuration
-#define HEAP_START      0x10000000  // Start at 256 MB virtual
+#define HEAP_START      0xD0000000  // Kernel half, shared by every address space
 #define HEAP_MAX_SIZE   (64 * 1024 * 1024)  // Max 64 MB
+#define HEAP_PAGES      (HEAP_MAX_SIZE / PAGE_SIZE)
+#define HEAP_MAP_BATCH  32      // Frames taken from the PMM at once
+
+// Two-level segregated fit (TLSF) allocator
+//
+// Free blocks are binned by size: the first level is the power of two
+// range, the second level splits that range into SL_INDEX_COUNT linear
+// slices. A bitmap per level tells which bins are non-empty, so both
+// kalloc() and kfree() are a couple of bit scans plus list operations, no
+// matter how many blocks there are.
+//
+// Every block carries an in-band header. Neighbours in memory are found
+// through the size (next) and prev_phys (previous), which is how kfree()
+// coalesces in O(1).
+//
+// The whole heap window starts out as one big free block but nothing is
+// mapped up front: pages are committed when a block needs them and pages
+// that end up entirely inside a free block go back to the PMM.
+#define ALIGN_SIZE_LOG2     3
+#define ALIGN_SIZE          (1 << ALIGN_SIZE_LOG2)
+#define SL_INDEX_COUNT_LOG2 4
+#define SL_INDEX_COUNT      (1 << SL_INDEX_COUNT_LOG2)
+#define FL_INDEX_SHIFT      (SL_INDEX_COUNT_LOG2 + ALIGN_SIZE_LOG2)
+#define FL_INDEX_MAX        26      // log2(HEAP_MAX_SIZE)
+#define FL_INDEX_COUNT      (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+#define SMALL_BLOCK_SIZE    (1 << FL_INDEX_SHIFT)
+
+#define BLOCK_FREE          0x1     // Low bits of size are flags
+#define BLOCK_SIZE_MASK     (~(uint32_t)(ALIGN_SIZE - 1))
+
+#if KHEAP_TAGS
+// Live usage of one allocation site
+typedef struct {
+    const char *subsys;
+    const char *file;
+    uint32_t line;
+    uint32_t live_bytes;    // Bytes requested by live allocations
+    uint32_t peak_bytes;
+    uint32_t allocs;
+    uint32_t frees;
+} heap_tag_t;
+
+#define HEAP_MAX_TAGS   128     // Sites tracked, later ones share the overflow tag
+#endif
+
+typedef struct heap_block {
+    struct heap_block *prev_phys;   // Previous block in memory, NULL for the first
+    uint32_t size;                  // Payload bytes | BLOCK_FREE
+#if KHEAP_TAGS
+    heap_tag_t *tag;                // Site that allocated the block
+    uint32_t requested;             // Bytes asked for
+#endif
+
+    // Only valid while the block is free, overlaps the payload otherwise
+    struct heap_block *next_free;
+    struct heap_block *prev_free;
+} heap_block_t;
+
+#define BLOCK_OVERHEAD      offsetof(heap_block_t, next_free)   // prev_phys + size (+ tag)
+#define FREE_HEADER_SIZE    sizeof(heap_block_t)
+#define BLOCK_MIN_SIZE      (FREE_HEADER_SIZE - BLOCK_OVERHEAD) // Room for the free list links
 
 // Heap state
-static uint32_t heap_start = 0;
-static uint32_t heap_end = 0;
-static uint32_t heap_current = 0;
+static uint32_t fl_bitmap = 0;
+static uint32_t sl_bitmap[FL_INDEX_COUNT];
+static heap_block_t *free_blocks[FL_INDEX_COUNT][SL_INDEX_COUNT];
 
-void kheap_init(void) {
-    klogf("[heap] Initializing kernel heap...\n");
-    
-    heap_start = HEAP_START;
-    heap_current = heap_start;
-    heap_end = heap_start;  // Will grow on demand
-    
-    klogf("[heap] Heap virtual address: 0x%08x\n", heap_start);
-    klogf("[heap] Maximum size: %u MB\n", HEAP_MAX_SIZE / (1024 * 1024));
-    klogf("[heap] Kernel heap initialized\n");
+static uint32_t committed[HEAP_PAGES / 32];     // 1 bit per mapped heap page
+static uint32_t committed_pages = 0;
+static uint32_t used_bytes = 0;
+static uint32_t peak_bytes = 0;
+
+#if KHEAP_TAGS
+static heap_tag_t tags[HEAP_MAX_TAGS];
+static heap_tag_t overflow_tag = { "(overflow)", "(other sites)", 0, 0, 0, 0, 0 };
+#endif
+
+// ----------------- Bit helpers -----------------
+
+// Index of the lowest / highest set bit (x must be non-zero)
+static inline uint32_t heap_ffs(uint32_t x) {
+    uint32_t r;
+    __asm__("bsf %1, %0" : "=r"(r) : "rm"(x));
+    return r;
 }
 
-void* kalloc(size_t size) {
-    if (size == 0) {
-        return NULL;
+static inline uint32_t heap_fls(uint32_t x) {
+    uint32_t r;
+    __asm__("bsr %1, %0" : "=r"(r) : "rm"(x));
+    return r;
+}
+
+// ----------------- Blocks -----------------
+
+static inline uint32_t block_size(const heap_block_t *block) {
+    return block->size & BLOCK_SIZE_MASK;
+}
+
+static inline bool block_is_free(const heap_block_t *block) {
+    return block->size & BLOCK_FREE;
+}
+
+static inline void *block_to_ptr(heap_block_t *block) {
+    return (uint8_t*)block + BLOCK_OVERHEAD;
+}
+
+static inline heap_block_t *ptr_to_block(void *ptr) {
+    return (heap_block_t*)((uint8_t*)ptr - BLOCK_OVERHEAD);
+}
+
+static inline heap_block_t *block_next(heap_block_t *block) {
+    return (heap_block_t*)((uint8_t*)block_to_ptr(block) + block_size(block));
+}
+
+// ----------------- Page commit -----------------
+
+static inline bool page_committed(uint32_t page) {
+    uint32_t idx = (page - HEAP_START) / PAGE_SIZE;
+    return committed[idx / 32] & (1u << (idx % 32));
+}
+
+static inline void page_set_committed(uint32_t page, bool on) {
+    uint32_t idx = (page - HEAP_START) / PAGE_SIZE;
+    if (on) {
+        committed[idx / 32] |= 1u << (idx % 32);
+    } else {
+        committed[idx / 32] &= ~(1u << (idx % 32));
     }
-    
-    // Align to 8 bytes
-    size = (size + 7) & ~7;
-    
-    // Check if we need more pages
-    while (heap_current + size > heap_end) {
-        // Check max size
-        if (heap_end >= heap_start + HEAP_MAX_SIZE) {
-            klogf("[heap] ERROR: Heap exhausted (max %u MB reached)\n",
-                  HEAP_MAX_SIZE / (1024 * 1024));
-            return NULL;
+}
+
+// Make sure every page touching [start, end) is mapped
+static bool heap_commit(uint32_t start, uint32_t end) {
+    void *frames[HEAP_MAP_BATCH];
+    uint32_t page = start & ~(PAGE_SIZE - 1);
+
+    while (page < end) {
+        if (page_committed(page)) {
+            page += PAGE_SIZE;
+            continue;
+        }
+
+        // Run of missing pages, mapped in one go
+        uint32_t count = 0;
+        while (count < HEAP_MAP_BATCH && page + count * PAGE_SIZE < end &&
+               !page_committed(page + count * PAGE_SIZE)) {
+            count++;
         }
-        
-        // Allocate and map one more page
-        if (!vmm_alloc_page(heap_end, PAGE_PRESENT | PAGE_RW)) {
+
+        if (pmm_alloc_batch(count, frames) < 0) {
             klogf("[heap] ERROR: Failed to allocate page for heap\n");
+            return false;
+        }
+
+        vmm_map_range(page, frames, count, PAGE_PRESENT | PAGE_RW);
+
+        for (uint32_t i = 0; i < count; i++) {
+            page_set_committed(page, true);
+            page += PAGE_SIZE;
+        }
+        committed_pages += count;
+    }
+
+    return true;
+}
+
+// Give back the pages in [start, end) (both page aligned)
+static void heap_release(uint32_t start, uint32_t end) {
+    uint32_t page = start;
+
+    while (page < end) {
+        if (!page_committed(page)) {
+            page += PAGE_SIZE;
+            continue;
+        }
+
+        uint32_t run = page;
+        while (page < end && page_committed(page)) {
+            page_set_committed(page, false);
+            page += PAGE_SIZE;
+        }
+
+        uint32_t count = (page - run) / PAGE_SIZE;
+        vmm_free_range(run, count);
+        committed_pages -= count;
+    }
+}
+
+// ----------------- Free lists -----------------
+
+static void mapping_insert(uint32_t size, uint32_t *fl, uint32_t *sl) {
+    if (size < SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
+    } else {
+        uint32_t f = heap_fls(size);
+        *sl = (size >> (f - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+        *fl = f - (FL_INDEX_SHIFT - 1);
+    }
+}
+
+// Round size up to the next bin so any block found there is big enough
+static void mapping_search(uint32_t size, uint32_t *fl, uint32_t *sl) {
+    if (size >= SMALL_BLOCK_SIZE) {
+        size += (1u << (heap_fls(size) - SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+static void free_list_insert(heap_block_t *block) {
+    uint32_t fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+
+    heap_block_t *head = free_blocks[fl][sl];
+    block->next_free = head;
+    block->prev_free = NULL;
+    if (head) {
+        head->prev_free = block;
+    }
+
+    free_blocks[fl][sl] = block;
+    fl_bitmap |= 1u << fl;
+    sl_bitmap[fl] |= 1u << sl;
+}
+
+static void free_list_remove(heap_block_t *block) {
+    uint32_t fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+
+    if (block->prev_free) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        free_blocks[fl][sl] = block->next_free;
+    }
+    if (block->next_free) {
+        block->next_free->prev_free = block->prev_free;
+    }
+
+    if (!free_blocks[fl][sl]) {
+        sl_bitmap[fl] &= ~(1u << sl);
+        if (!sl_bitmap[fl]) {
+            fl_bitmap &= ~(1u << fl);
+        }
+    }
+}
+
+// First free block in the smallest non-empty bin at or above (fl, sl)
+static heap_block_t *free_list_find(uint32_t fl, uint32_t sl) {
+    if (fl >= FL_INDEX_COUNT) {
+        return NULL;
+    }
+
+    uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+    if (!sl_map) {
+        uint32_t fl_map = (fl + 1 < 32) ? fl_bitmap & (~0u << (fl + 1)) : 0;
+        if (!fl_map) {
             return NULL;
         }
-        
-        heap_end += PAGE_SIZE;
-        
-        // Log when we grow (but not too spammy)
-        static uint32_t last_log_size = 0;
-        uint32_t current_size = heap_end - heap_start;
-        if (current_size - last_log_size >= 64 * 1024) {  // Log every 64KB
-            klogf("[heap] Grew to %u KB\n", current_size / 1024);
-            last_log_size = current_size;
+
+        fl = heap_ffs(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+
+    return free_blocks[fl][heap_ffs(sl_map)];
+}
+
+// ----------------- Tags -----------------
+
+#if KHEAP_TAGS
+// Find or claim the slot for a call site. Sites are told apart by the
+// address of their __FILE__ string and their line, both constant.
+static heap_tag_t *heap_tag_get(const char *subsys, const char *file, uint32_t line) {
+    uint32_t hash = ((uint32_t)file >> 2) ^ (line * 2654435761u);
+
+    for (uint32_t i = 0; i < HEAP_MAX_TAGS; i++) {
+        heap_tag_t *tag = &tags[(hash + i) % HEAP_MAX_TAGS];
+
+        if (tag->file == file && tag->line == line) {
+            return tag;
+        }
+        if (!tag->file) {
+            tag->subsys = subsys;
+            tag->file = file;
+            tag->line = line;
+            return tag;
         }
     }
-    
-    // Allocate from bump pointer
-    void *ptr = (void*)heap_current;
-    heap_current += size;
-    
-    return ptr;
+
+    return &overflow_tag;
+}
+
+static const char *heap_basename(const char *path) {
+    const char *base = path;
+    for (const char *p = path; *p; p++) {
+        if (*p == '/') {
+            base = p + 1;
+        }
+    }
+    return base;
+}
+#endif
+
+// ----------------- Public API -----------------
+
+void kheap_init(void) {
+    klogf("[heap] Initializing kernel heap...\n");
+
+    fl_bitmap = 0;
+    memset(sl_bitmap, 0, sizeof(sl_bitmap));
+    memset(free_blocks, 0, sizeof(free_blocks));
+    memset(committed, 0, sizeof(committed));
+    committed_pages = 0;
+    used_bytes = 0;
+    peak_bytes = 0;
+
+    // One free block spanning the window, closed by a zero sized, never
+    // free sentinel so coalescing always stops at the end
+    heap_block_t *first = (heap_block_t*)HEAP_START;
+    heap_block_t *sentinel = (heap_block_t*)(HEAP_START + HEAP_MAX_SIZE - BLOCK_OVERHEAD);
+
+    if (!heap_commit((uint32_t)first, (uint32_t)first + FREE_HEADER_SIZE) ||
+        !heap_commit((uint32_t)sentinel, (uint32_t)sentinel + BLOCK_OVERHEAD)) {
+        klogf("[heap] ERROR: Could not map heap bookkeeping\n");
+        return;
+    }
+
+    first->prev_phys = NULL;
+    first->size = ((uint32_t)sentinel - (uint32_t)block_to_ptr(first)) | BLOCK_FREE;
+    free_list_insert(first);
+
+    sentinel->prev_phys = first;
+    sentinel->size = 0;
+
+    klogf("[heap] Heap virtual address: 0x%08x\n", HEAP_START);
+    klogf("[heap] Maximum size: %u MB\n", HEAP_MAX_SIZE / (1024 * 1024));
+    klogf("[heap] Kernel heap initialized\n");
 }
 
+static heap_block_t *heap_alloc(size_t size) {
+    if (size == 0 || size > HEAP_MAX_SIZE) {
+        return NULL;
+    }
+
+    // Align to 8 bytes, and leave room for the free list links once freed
+    size = (size + ALIGN_SIZE - 1) & ~(ALIGN_SIZE - 1);
+    if (size < BLOCK_MIN_SIZE) {
+        size = BLOCK_MIN_SIZE;
+    }
+
+    uint32_t fl, sl;
+    mapping_search(size, &fl, &sl);
+
+    heap_block_t *block = free_list_find(fl, sl);
+    if (!block) {
+        klogf("[heap] ERROR: Heap exhausted (no free block for %u bytes)\n", (uint32_t)size);
+        return NULL;
+    }
+
+    // Split off the tail if it can hold a block of its own
+    uint32_t total = block_size(block);
+    bool split = total >= size + FREE_HEADER_SIZE;
+    uint32_t map_end = (uint32_t)block_to_ptr(block) + size;
+
+    if (split) {
+        map_end += FREE_HEADER_SIZE;
+    }
+
+    if (!heap_commit((uint32_t)block, map_end)) {
+        return NULL;
+    }
+
+    free_list_remove(block);
+
+    if (split) {
+        heap_block_t *rest = (heap_block_t*)((uint8_t*)block_to_ptr(block) + size);
+        rest->prev_phys = block;
+        rest->size = (total - size - BLOCK_OVERHEAD) | BLOCK_FREE;
+        block_next(rest)->prev_phys = rest;
+        free_list_insert(rest);
+
+        block->size = size;
+    } else {
+        block->size = total;
+    }
+
+    used_bytes += block_size(block);
+    if (used_bytes > peak_bytes) {
+        peak_bytes = used_bytes;
+    }
+
+    // Log when we grow (but not too spammy)
+    static uint32_t last_log_size = 0;
+    uint32_t current_size = committed_pages * PAGE_SIZE;
+    if (current_size - last_log_size >= 64 * 1024) {  // Log every 64KB
+        klogf("[heap] Grew to %u KB\n", current_size / 1024);
+        last_log_size = current_size;
+    }
+
+    return block;
+}
+
+#if KHEAP_TAGS
+void* kalloc_tagged(size_t size, const char *subsys, const char *file, uint32_t line) {
+    heap_block_t *block = heap_alloc(size);
+    if (!block) {
+        return NULL;
+    }
+
+    heap_tag_t *tag = heap_tag_get(subsys, file, line);
+    tag->live_bytes += size;
+    if (tag->live_bytes > tag->peak_bytes) {
+        tag->peak_bytes = tag->live_bytes;
+    }
+    tag->allocs++;
+
+    block->tag = tag;
+    block->requested = size;
+    return block_to_ptr(block);
+}
+#else
+void* kalloc(size_t size) {
+    heap_block_t *block = heap_alloc(size);
+    return block ? block_to_ptr(block) : NULL;
+}
+#endif
+
 void kfree(void *ptr) {
-    // Bump allocator doesn't support freeing
-    // Not yet at least, we'll get around to it.
-    (void)ptr;
+    if (!ptr) {
+        return;
+    }
+
+    uint32_t addr = (uint32_t)ptr;
+    if (addr < HEAP_START + BLOCK_OVERHEAD || addr >= HEAP_START + HEAP_MAX_SIZE ||
+        (addr & (ALIGN_SIZE - 1))) {
+        klogf("[heap] ERROR: kfree of non-heap pointer 0x%08x\n", addr);
+        return;
+    }
+
+    heap_block_t *block = ptr_to_block(ptr);
+    if (block_is_free(block)) {
+        klogf("[heap] WARNING: Double free of 0x%08x\n", addr);
+        return;
+    }
+
+    used_bytes -= block_size(block);
+
+#if KHEAP_TAGS
+    block->tag->live_bytes -= block->requested;
+    block->tag->frees++;
+#endif
+
+    // Only these bytes may hold pages that are now unused, everything else
+    // in the merged block already had its pages released
+    uint32_t dirty_start = (uint32_t)block;
+    uint32_t dirty_end = (uint32_t)block_next(block) + FREE_HEADER_SIZE;
+
+    heap_block_t *next = block_next(block);
+    if (block_is_free(next)) {
+        free_list_remove(next);
+        block->size = block_size(block) + BLOCK_OVERHEAD + block_size(next);
+    }
+
+    heap_block_t *prev = block->prev_phys;
+    if (prev && block_is_free(prev)) {
+        free_list_remove(prev);
+        prev->size = block_size(prev) + BLOCK_OVERHEAD + block_size(block);
+        block = prev;
+    }
+
+    block->size |= BLOCK_FREE;
+    block_next(block)->prev_phys = block;
+    free_list_insert(block);
+
+    // Pages touching the dirty bytes can go, as long as they lie wholly
+    // past the free block's header and links and before the next header
+    uint32_t keep_start = ((uint32_t)block + FREE_HEADER_SIZE + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint32_t keep_end = (uint32_t)block_next(block) & ~(PAGE_SIZE - 1);
+
+    dirty_start &= ~(PAGE_SIZE - 1);
+    dirty_end = (dirty_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    if (dirty_start < keep_start) dirty_start = keep_start;
+    if (dirty_end > keep_end) dirty_end = keep_end;
+
+    if (dirty_start < dirty_end) {
+        heap_release(dirty_start, dirty_end);
+    }
 }
 
 uint32_t kheap_get_used(void) {
-    return heap_current - heap_start;
+    return used_bytes;
 }
 
 uint32_t kheap_get_size(void) {
-    return heap_end - heap_start;
-}
\ No newline at end of file
+    return committed_pages * PAGE_SIZE;
+}
+
+void kheap_dump_stats(void) {
+    klogf("[heap] ===== Heap Statistics =====\n");
+    klogf("[heap] Used: %u KB (peak %u KB)\n", used_bytes / 1024, peak_bytes / 1024);
+    klogf("[heap] Committed: %u KB of %u MB\n",
+          committed_pages * PAGE_SIZE / 1024, HEAP_MAX_SIZE / (1024 * 1024));
+
+#if KHEAP_TAGS
+    klogf("[heap] Allocation sites (live / peak bytes, allocs / frees):\n");
+    for (uint32_t i = 0; i <= HEAP_MAX_TAGS; i++) {
+        heap_tag_t *tag = (i < HEAP_MAX_TAGS) ? &tags[i] : &overflow_tag;
+        if (tag->allocs == 0) {
+            continue;
+        }
+
+        klogf("[heap]   %s %s:%u: %u / %u, %u / %u\n",
+              tag->subsys, heap_basename(tag->file), tag->line,
+              tag->live_bytes, tag->peak_bytes, tag->allocs, tag->frees);
+    }
+#else
+    klogf("[heap] Allocation tags disabled (build with KHEAP_TAGS=1)\n");
+#endif
+
+    klogf("[heap] =============================\n");
+}
@@ -3,13 +3,16 @@
  * @brief Kernel Heap Allocator
  * 
  * Provides dynamic memory allocation for the kernel through kalloc/kfree.
- * Currently implements a simple bump allocator that grows upward from a
- * base address. Free operations are stubbed (memory is not reclaimed).
- * 
- * @note This is a temporary implementation. A proper heap with free support
- *       (e.g., linked list or buddy allocator) should be implemented later.
- * 
- * @warning kfree() is currently a no-op - memory cannot be reclaimed!
+ * Implemented as a two-level segregated fit (TLSF) allocator: both kalloc()
+ * and kfree() run in constant time, freed blocks coalesce with their
+ * neighbours right away, and heap pages that become entirely free are
+ * handed back to the PMM.
+ *
+ * With KHEAP_TAGS enabled (the default, build with KHEAP_TAGS=0 to drop
+ * it), every kalloc() is charged to its call site and to a subsystem
+ * name, and kheap_dump_stats() lists live and peak bytes per site. A
+ * source file picks its subsystem name by defining KHEAP_SUBSYS before
+ * its first include.
  */
 
 #ifndef HEAP_H
@@ -18,13 +21,20 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#ifndef KHEAP_TAGS
+#define KHEAP_TAGS 0
+#endif
+
+#ifndef KHEAP_SUBSYS
+#define KHEAP_SUBSYS "kernel"
+#endif
+
 /**
  * @brief Initialize the kernel heap
  * 
- * Sets up the kernel heap allocator with an initial memory region.
+ * Sets up the kernel heap allocator over its virtual window. Pages are
+ * only mapped as allocations need them.
  * Must be called after the VMM is initialized and before any kalloc() calls.
- * 
- * @note Currently uses a bump allocator strategy
  */
 void kheap_init(void);
 
@@ -32,40 +42,50 @@ void kheap_init(void);
  * @brief Allocate memory from the kernel heap
  * 
  * Allocates a block of at least 'size' bytes from the kernel heap.
- * The returned pointer is aligned and points to virtual memory.
+ * The returned pointer is 8-byte aligned and points to virtual memory.
  * 
  * @param size Number of bytes to allocate
  * @return Virtual address of allocated memory, or NULL on failure
- * 
- * @warning Memory allocated with kalloc() cannot currently be freed!
  */
+#if KHEAP_TAGS
+void* kalloc_tagged(size_t size, const char *subsys, const char *file, uint32_t line);
+#define kalloc(size) kalloc_tagged((size), KHEAP_SUBSYS, __FILE__, __LINE__)
+#else
 void* kalloc(size_t size);
+#endif
 
 /**
  * @brief Free allocated memory
  * 
- * @param ptr Pointer to memory previously allocated with kalloc()
+ * Returns the block to the heap and merges it with free neighbours.
+ * Pages left entirely free are unmapped and returned to the PMM.
+ * kfree(NULL) does nothing; double frees are logged and ignored.
  * 
- * @warning STUB IMPLEMENTATION - Does nothing! The bump allocator
- *          does not support freeing memory. This function exists
- *          for API compatibility with future heap implementations.
- * 
- * @todo Implement proper heap with free support
+ * @param ptr Pointer to memory previously allocated with kalloc()
  */
 void kfree(void *ptr);
 
 /**
  * @brief Get amount of heap memory currently allocated
  * 
- * @return Number of bytes allocated from the heap (since init)
+ * @return Number of bytes in live allocations (rounded up to the
+ *         allocator's 8-byte granularity)
  */
 uint32_t kheap_get_used(void);
 
 /**
  * @brief Get total size of the heap
  * 
- * @return Total heap size in bytes (maximum addressable space)
+ * @return Bytes of heap currently backed by physical frames
  */
 uint32_t kheap_get_size(void);
 
+/**
+ * @brief Print heap usage to the kernel log
+ * 
+ * Totals always; live bytes, peak bytes and alloc/free counts per
+ * allocation site when built with KHEAP_TAGS.
+ */
+void kheap_dump_stats(void);
+
 #endif // HEAP_H
\ No newline at end of file
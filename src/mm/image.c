@@ -0,0 +1,170 @@
+#include "image.h"
+#include "heap.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "kernel/log.h"
+#include "../libk/string.h"
+
+#define IMAGE_IDLE_MAX  8       // Unreferenced images kept around
+
+struct image {
+    uint32_t dev;
+    uint32_t inode;
+    uint32_t size;
+    uint32_t refs;
+    uint32_t released;          // Stamp of the last image_put() to zero refs
+    uint32_t pages;
+    uint32_t frames_cached;     // Non-zero entries of frames
+    uint32_t *frames;           // Physical address per file page, 0 = not cached
+    struct image *next;
+};
+
+static image_t *images = NULL;
+static uint32_t idle_count = 0;
+static uint32_t release_clock = 0;
+
+static void image_free(image_t *image) {
+    image_t **link = &images;
+    while (*link != image) {
+        link = &(*link)->next;
+    }
+    *link = image->next;
+
+    for (uint32_t i = 0; i < image->pages; i++) {
+        if (image->frames[i]) {
+            pmm_free_frame((void*)image->frames[i]);
+        }
+    }
+
+    klogf("[image] Dropped image %u:%u (%u pages cached)\n",
+          image->dev, image->inode, image->frames_cached);
+
+    kfree(image->frames);
+    kfree(image);
+}
+
+// Drop the least recently released idle image
+static void image_evict_idle(void) {
+    image_t *oldest = NULL;
+    for (image_t *image = images; image; image = image->next) {
+        if (image->refs == 0 && (!oldest || image->released < oldest->released)) {
+            oldest = image;
+        }
+    }
+
+    if (oldest) {
+        idle_count--;
+        image_free(oldest);
+    }
+}
+
+// PMM reclaim hook: release the cached pages of the least recently
+// released idle image that still has any. The image itself stays (empty)
+// since the heap may be in the middle of the failing allocation.
+static bool image_reclaim(void) {
+    image_t *oldest = NULL;
+    for (image_t *image = images; image; image = image->next) {
+        if (image->refs == 0 && image->frames_cached > 0 &&
+            (!oldest || image->released < oldest->released)) {
+            oldest = image;
+        }
+    }
+
+    if (!oldest) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < oldest->pages; i++) {
+        if (oldest->frames[i]) {
+            pmm_free_frame((void*)oldest->frames[i]);
+            oldest->frames[i] = 0;
+        }
+    }
+
+    klogf("[image] Reclaimed %u pages of idle image %u:%u\n",
+          oldest->frames_cached, oldest->dev, oldest->inode);
+    oldest->frames_cached = 0;
+    return true;
+}
+
+void image_init(void) {
+    if (pmm_register_reclaim(image_reclaim) < 0) {
+        klogf("[image] Can't register reclaim hook, idle images stay resident\n");
+    }
+}
+
+image_t *image_get(uint32_t dev, uint32_t inode, uint32_t size) {
+    for (image_t *image = images; image; image = image->next) {
+        if (image->dev != dev || image->inode != inode) {
+            continue;
+        }
+
+        if (image->size == size) {
+            if (image->refs++ == 0) {
+                idle_count--;
+            }
+            return image;
+        }
+
+        // The file changed under a stale image
+        if (image->refs > 0) {
+            return NULL;
+        }
+        idle_count--;
+        image_free(image);
+        break;
+    }
+
+    image_t *image = kalloc(sizeof(image_t));
+    if (!image) {
+        return NULL;
+    }
+
+    image->pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    image->frames = kalloc((image->pages ? image->pages : 1) * sizeof(uint32_t));
+    if (!image->frames) {
+        kfree(image);
+        return NULL;
+    }
+    memset(image->frames, 0, image->pages * sizeof(uint32_t));
+
+    image->dev = dev;
+    image->inode = inode;
+    image->size = size;
+    image->refs = 1;
+    image->released = 0;
+    image->frames_cached = 0;
+    image->next = images;
+    images = image;
+    return image;
+}
+
+void image_put(image_t *image) {
+    if (!image || --image->refs > 0) {
+        return;
+    }
+
+    image->released = ++release_clock;
+    if (++idle_count > IMAGE_IDLE_MAX) {
+        image_evict_idle();
+    }
+}
+
+uint32_t image_lookup(image_t *image, uint32_t page) {
+    return (page < image->pages) ? image->frames[page] : 0;
+}
+
+void image_insert(image_t *image, uint32_t page, uint32_t phys) {
+    if (page >= image->pages || image->frames[page]) {
+        return;
+    }
+
+    page_t *desc = pmm_phys_to_page((void*)phys);
+    if (!desc) {
+        return;
+    }
+
+    page_get(desc);
+    image->frames[page] = phys & ~0xFFF;
+    image->frames_cached++;
+}
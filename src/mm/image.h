@@ -0,0 +1,77 @@
+/**
+ * @file image.h
+ * @brief Executable Image Cache
+ * 
+ * Keeps the read-only pages of executables resident so every process
+ * running the same binary maps the same frames. An image stands for one
+ * file, identified by (device, inode), and remembers which of its file
+ * pages are already in memory. The first process to touch a text page
+ * reads it from the file and hands the frame to the image; later
+ * processes map that frame read-only instead of reading and allocating
+ * their own.
+ * 
+ * Images are referenced by the file areas mapping them (see vma_file_t).
+ * Once unreferenced, a few of them are kept with their pages so the next
+ * exec of a recently run program starts warm; past that, the least
+ * recently released one is dropped. When the PMM runs out of frames the
+ * idle images give their pages back, oldest first (see image_init()).
+ * 
+ * Only whole pages of file data are cached. Writable pages are always
+ * private copies and never come from here.
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+
+typedef struct image image_t;
+
+/**
+ * @brief Let the PMM reclaim the pages of idle images
+ * 
+ * Registers the cache's reclaim hook (see pmm_register_reclaim()). Call
+ * once the PMM is up.
+ */
+void image_init(void);
+
+/**
+ * @brief Get the image of a file
+ * 
+ * @param dev Device the file lives on (stat_t.dev)
+ * @param inode Inode of the file
+ * @param size Size of the file in bytes
+ * @return The image with a new reference, or NULL if out of memory or
+ *         an image of a different size is still in use
+ */
+image_t *image_get(uint32_t dev, uint32_t inode, uint32_t size);
+
+/**
+ * @brief Drop a reference to an image
+ * 
+ * @param image Image from image_get() (NULL is ignored)
+ */
+void image_put(image_t *image);
+
+/**
+ * @brief Look up a cached page
+ * 
+ * @param image Image
+ * @param page File page number (file offset / PAGE_SIZE)
+ * @return Physical address of the frame holding it, or 0 if not cached
+ */
+uint32_t image_lookup(image_t *image, uint32_t page);
+
+/**
+ * @brief Add a page to an image
+ * 
+ * The image takes its own reference to the frame, which must hold the
+ * full page of file data and never be written again.
+ * 
+ * @param image Image
+ * @param page File page number
+ * @param phys Physical address of the frame
+ */
+void image_insert(image_t *image, uint32_t page, uint32_t phys);
+
+#endif // IMAGE_H
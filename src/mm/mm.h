@@ -38,7 +38,12 @@
 
 #include "pmm.h"
 #include "vmm.h"
+#include "vma.h"
+#include "image.h"
 #include "heap.h"
+#include "slab.h"
+#include "arena.h"
+#include "vmalloc.h"
 
 /** @} */
 
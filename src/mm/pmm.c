@@ -1,67 +1,1051 @@
 #include "pmm.h"
 #include "../kernel/multiboot.h"
+#include "../kernel/panic.h"
 #include "../libk/kprint.h"
 #include "../libk/string.h"
 #include "kernel/log.h"
 #include "mm/mboot.h"
+#include "mm/vmm.h"
 #include <stdint.h>
 
 // Bitmap allocator: 1 bit per frame
-// 0 = free, 1 = used
-#define MAX_MEMORY (1024 * 1024 * 1024)  // Support up to 1GB (yay)
-#define MAX_FRAMES (MAX_MEMORY / FRAME_SIZE)
-#define BITMAP_SIZE (MAX_FRAMES / 8)
+// 1 = free, 0 = used
+//
+// On top of every bitmap sit two summary levels so that finding a set bit
+// never walks the bitmap bit by bit:
+//   level 1: 1 bit per bitmap word, set if that word has any bit set
+//   level 2: 1 bit per level 1 word, set if that word has any bit set
+// A lookup is a bsf on a handful of words no matter how full memory is.
+//
+// The frame bitmap is the source of truth for every frame. Beside it sits a
+// binary buddy index (one summary bitmap per order, bit set = free block of
+// that order) that tracks physically contiguous free runs for
+// pmm_alloc_frames(). Both are kept in sync on every alloc/free.
+//
+// None of this is static: pmm_init() sizes the bitmaps for the highest
+// usable frame in the memory map and carves them out of RAM just past the
+// kernel image with a small boot-time bump allocator.
+#define PMM_FRAME_LIMIT 0x100000            // 4GB worth of frames (32-bit limit)
+#define BUDDY_FRAMES (1u << PMM_MAX_ORDER)  // Frames per max order block
 
-static uint8_t frame_bitmap[BITMAP_SIZE];
+#define NO_FRAME 0xFFFFFFFF
+
+typedef struct {
+    uint32_t *l0;           // 1 bit per item
+    uint32_t *l1;           // 1 bit per l0 word
+    uint32_t *l2;           // 1 bit per l1 word
+    uint32_t nbits;
+    uint32_t l0_words;
+    uint32_t l1_words;
+    uint32_t l2_words;
+} sbitmap_t;
+
+static sbitmap_t frame_bitmap;
+static sbitmap_t buddy_free[PMM_MAX_ORDER + 1];
+static uint32_t buddy_free_count[PMM_MAX_ORDER + 1];
+
+static page_t *pages = NULL;        // One descriptor per frame
+static uint32_t max_frames = 0;     // Frames covered by the metadata
 static uint32_t total_frames = 0;
 static uint32_t used_frames = 0;
 
-static inline bool test_bit(uint32_t frame) {
-    return frame_bitmap[frame / 8] & (1 << (frame % 8));
+// Physical ranges the bootloader and linker already filled: the PMM never
+// hands them out and never places its own metadata on top of them
+typedef struct {
+    const char *name;
+    uint32_t start;
+    uint32_t end;
+} boot_range_t;
+
+#define MAX_BOOT_RANGES 5
+static boot_range_t boot_ranges[MAX_BOOT_RANGES];
+static uint32_t boot_range_count = 0;
+
+// Zone boundaries must stay multiples of the largest buddy block (4MB) so
+// no buddy block ever straddles two zones. HIGH ends wherever the memory
+// map does, pmm_init() fills that in.
+typedef struct {
+    const char *name;
+    uint32_t start;     // First frame of the zone
+    uint32_t end;       // One past the last frame of the zone
+    uint32_t present;   // Usable frames reported by the memory map
+    uint32_t free;      // Currently free frames
+    uint32_t hint;      // No frame in [start, hint) is free
+    uint32_t zero_list; // Pre-zeroed frames, linked through page_t.lru_next
+    uint32_t zero_count;
+    uint32_t zero_target;
+} zone_t;
+
+// Frames zeroed per pmm_zero_pool_refill() call, small enough that an idle
+// loop still notices a keypress promptly
+#define ZERO_POOL_BATCH 4
+
+static zone_t zones[PMM_ZONE_COUNT] = {
+    { "DMA",    0,                               PMM_DMA_LIMIT / FRAME_SIZE,    0, 0, 0, 0, 0, 0 },
+    { "DIRECT", PMM_DMA_LIMIT / FRAME_SIZE,      DIRECT_MAP_LIMIT / FRAME_SIZE, 0, 0, 0, 0, 0, 0 },
+    { "HIGH",   DIRECT_MAP_LIMIT / FRAME_SIZE,   DIRECT_MAP_LIMIT / FRAME_SIZE, 0, 0, 0, 0, 0, 64 },
+};
+
+static uint32_t zero_pool_hits = 0;
+static uint32_t zero_pool_misses = 0;
+
+// Recently freed HIGH frames, handed out again LIFO while they're still
+// cache-warm. Like pooled frames they are out of the bitmap but count as free.
+#define FREE_CACHE_SIZE 64
+static uint32_t free_cache[FREE_CACHE_SIZE];
+static uint32_t free_cache_count = 0;
+
+// Caches that give frames back before an allocation fails
+#define MAX_RECLAIM_HOOKS 4
+static pmm_reclaim_t reclaim_hooks[MAX_RECLAIM_HOOKS];
+static uint32_t reclaim_hook_count = 0;
+
+// Index of the lowest set bit (x must be non-zero)
+static inline uint32_t bsf(uint32_t x) {
+    uint32_t r;
+    __asm__("bsf %1, %0" : "=r"(r) : "rm"(x));
+    return r;
 }
 
-static inline void set_bit(uint32_t frame) {
-    frame_bitmap[frame / 8] |= (1 << (frame % 8));
+// ----------------- Summary bitmaps -----------------
+
+// Words needed for a summary bitmap of nbits items (all three levels)
+static uint32_t sbm_words(uint32_t nbits) {
+    uint32_t l0 = (nbits + 31) / 32;
+    uint32_t l1 = (l0 + 31) / 32;
+    uint32_t l2 = (l1 + 31) / 32;
+    return l0 + l1 + l2;
 }
 
-static inline void clear_bit(uint32_t frame) {
-    frame_bitmap[frame / 8] &= ~(1 << (frame % 8));
+// Lay a cleared bitmap of nbits items out at pool, return the first word past it
+static uint32_t *sbm_setup(sbitmap_t *bm, uint32_t nbits, uint32_t *pool) {
+    bm->nbits = nbits;
+    bm->l0_words = (nbits + 31) / 32;
+    bm->l1_words = (bm->l0_words + 31) / 32;
+    bm->l2_words = (bm->l1_words + 31) / 32;
+
+    bm->l0 = pool; pool += bm->l0_words;
+    bm->l1 = pool; pool += bm->l1_words;
+    bm->l2 = pool; pool += bm->l2_words;
+
+    memset(bm->l0, 0, sbm_words(nbits) * sizeof(uint32_t));
+    return pool;
 }
 
-void pmm_mark_used(uint32_t frame) {
-    if (frame >= MAX_FRAMES) return;
-    
-    if (!test_bit(frame)) {
-        set_bit(frame);
+static inline bool sbm_test(const sbitmap_t *bm, uint32_t i) {
+    return bm->l0[i / 32] & (1u << (i % 32));
+}
+
+static inline void sbm_set(sbitmap_t *bm, uint32_t i) {
+    uint32_t w = i / 32;
+
+    bm->l0[w] |= 1u << (i % 32);
+    bm->l1[w / 32] |= 1u << (w % 32);
+    bm->l2[w / 1024] |= 1u << ((w / 32) % 32);
+}
+
+// Clear the bit, then drop emptied words from the summaries
+static inline void sbm_clear(sbitmap_t *bm, uint32_t i) {
+    uint32_t w = i / 32;
+
+    bm->l0[w] &= ~(1u << (i % 32));
+    if (bm->l0[w] == 0) {
+        bm->l1[w / 32] &= ~(1u << (w % 32));
+        if (bm->l1[w / 32] == 0) {
+            bm->l2[w / 1024] &= ~(1u << ((w / 32) % 32));
+        }
+    }
+}
+
+// Find the first set bit >= from, or NO_FRAME
+static uint32_t sbm_find(const sbitmap_t *bm, uint32_t from) {
+    while (from < bm->nbits) {
+        uint32_t w = from / 32;
+        uint32_t bits = bm->l0[w] & (~0u << (from % 32));
+        if (bits) {
+            return w * 32 + bsf(bits);
+        }
+
+        // Rest of this word is clear, ask level 1 for the next non-empty word
+        uint32_t next_w = w + 1;
+        if (next_w >= bm->l0_words) break;
+
+        uint32_t w1 = next_w / 32;
+        uint32_t bits1 = bm->l1[w1] & (~0u << (next_w % 32));
+        if (bits1) {
+            from = (w1 * 32 + bsf(bits1)) * 32;
+            continue;
+        }
+
+        // Nothing in this level 1 word either, go up to level 2
+        uint32_t next_w1 = w1 + 1;
+        if (next_w1 >= bm->l1_words) break;
+
+        uint32_t w2 = next_w1 / 32;
+        uint32_t bits2 = bm->l2[w2] & (~0u << (next_w1 % 32));
+        while (!bits2) {
+            if (++w2 >= bm->l2_words) return NO_FRAME;
+            bits2 = bm->l2[w2];
+        }
+
+        uint32_t found_w1 = w2 * 32 + bsf(bits2);
+        from = (found_w1 * 32 + bsf(bm->l1[found_w1])) * 32;
+    }
+
+    return NO_FRAME;
+}
+
+static inline uint32_t popcount(uint32_t x) {
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    x = (x + (x >> 4)) & 0x0F0F0F0F;
+    return (x * 0x01010101) >> 24;
+}
+
+// Mask of bits [lo, hi) within one word (0 <= lo < hi <= 32)
+static inline uint32_t word_mask(uint32_t lo, uint32_t hi) {
+    uint32_t upper = (hi == 32) ? ~0u : ((1u << hi) - 1);
+    return upper & (~0u << lo);
+}
+
+// Number of set bits in [start, end)
+static uint32_t sbm_count(const sbitmap_t *bm, uint32_t start, uint32_t end) {
+    uint32_t count = 0;
+
+    while (start < end) {
+        uint32_t w = start / 32;
+        uint32_t hi = (end - w * 32 < 32) ? end - w * 32 : 32;
+        count += popcount(bm->l0[w] & word_mask(start % 32, hi));
+        start = w * 32 + hi;
+    }
+
+    return count;
+}
+
+// Rebuild the summary bits covering l0 words [w_start, w_end]
+static void sbm_resummarize(sbitmap_t *bm, uint32_t w_start, uint32_t w_end) {
+    for (uint32_t w1 = w_start / 32; w1 <= w_end / 32; w1++) {
+        uint32_t bits = 0;
+        for (uint32_t i = 0; i < 32 && w1 * 32 + i < bm->l0_words; i++) {
+            if (bm->l0[w1 * 32 + i]) bits |= 1u << i;
+        }
+        bm->l1[w1] = bits;
+    }
+
+    for (uint32_t w2 = w_start / 1024; w2 <= w_end / 1024; w2++) {
+        uint32_t bits = 0;
+        for (uint32_t i = 0; i < 32 && w2 * 32 + i < bm->l1_words; i++) {
+            if (bm->l1[w2 * 32 + i]) bits |= 1u << i;
+        }
+        bm->l2[w2] = bits;
+    }
+}
+
+// Set or clear every bit in [start, end): whole words are filled with
+// memset, only the two edge words are patched bit-wise
+static void sbm_fill(sbitmap_t *bm, uint32_t start, uint32_t end, bool set) {
+    if (start >= end) return;
+
+    uint32_t w_first = start / 32;
+    uint32_t w_last = (end - 1) / 32;
+
+    if (w_first == w_last) {
+        uint32_t mask = word_mask(start % 32, end - w_first * 32);
+        if (set) bm->l0[w_first] |= mask;
+        else bm->l0[w_first] &= ~mask;
+    } else {
+        uint32_t head = word_mask(start % 32, 32);
+        uint32_t tail = word_mask(0, end - w_last * 32);
+
+        if (set) {
+            bm->l0[w_first] |= head;
+            bm->l0[w_last] |= tail;
+        } else {
+            bm->l0[w_first] &= ~head;
+            bm->l0[w_last] &= ~tail;
+        }
+
+        memset(&bm->l0[w_first + 1], set ? 0xFF : 0x00,
+               (w_last - w_first - 1) * sizeof(uint32_t));
+    }
+
+    sbm_resummarize(bm, w_first, w_last);
+}
+
+static inline bool frame_is_used(uint32_t frame) {
+    return !sbm_test(&frame_bitmap, frame);
+}
+
+// ----------------- Buddy index -----------------
+
+// Lay the per-order bitmaps out at pool, return the first word past them
+static uint32_t *buddy_init(uint32_t *pool) {
+    memset(buddy_free_count, 0, sizeof(buddy_free_count));
+
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        pool = sbm_setup(&buddy_free[order], max_frames >> order, pool);
+    }
+
+    return pool;
+}
+
+// Add a free block (all of its frames already free) and coalesce upward
+static void buddy_insert(uint32_t frame, uint32_t order) {
+    uint32_t idx = frame >> order;
+
+    while (order < PMM_MAX_ORDER && sbm_test(&buddy_free[order], idx ^ 1)) {
+        sbm_clear(&buddy_free[order], idx ^ 1);
+        buddy_free_count[order]--;
+        idx >>= 1;
+        order++;
+    }
+
+    sbm_set(&buddy_free[order], idx);
+    buddy_free_count[order]++;
+}
+
+// Split a free block of 'order' down to 'target', keeping the half that
+// contains 'frame' and releasing the other halves at each lower order
+static void buddy_split(uint32_t frame, uint32_t order, uint32_t target) {
+    while (order > target) {
+        order--;
+        uint32_t other = (frame >> order) ^ 1;
+        sbm_set(&buddy_free[order], other);
+        buddy_free_count[order]++;
+    }
+}
+
+// A single free frame is being taken: pull its enclosing free block out of
+// the index and split it so every other frame stays indexed
+static void buddy_carve(uint32_t frame) {
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        uint32_t idx = frame >> order;
+
+        if (sbm_test(&buddy_free[order], idx)) {
+            sbm_clear(&buddy_free[order], idx);
+            buddy_free_count[order]--;
+            buddy_split(frame, order, 0);
+            return;
+        }
+    }
+}
+
+// Index every frame of [start, end) (all already free) as the largest
+// aligned blocks that fit, coalescing with free neighbours
+static void buddy_insert_range(uint32_t start, uint32_t end) {
+    while (start < end) {
+        uint32_t order = PMM_MAX_ORDER;
+        while (order > 0 && ((start & ((1u << order) - 1)) || start + (1u << order) > end)) {
+            order--;
+        }
+
+        buddy_insert(start, order);
+        start += 1u << order;
+    }
+}
+
+// Pull every free frame of [start, end) out of the index. Each free block
+// that overlaps the range is removed whole, and the parts of it outside
+// the range are put back.
+static void buddy_remove_range(uint32_t start, uint32_t end) {
+    uint32_t frame = sbm_find(&frame_bitmap, start);
+
+    while (frame < end) {
+        uint32_t next = frame + 1;
+
+        for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+            uint32_t idx = frame >> order;
+
+            if (sbm_test(&buddy_free[order], idx)) {
+                uint32_t block_start = idx << order;
+                uint32_t block_end = block_start + (1u << order);
+
+                sbm_clear(&buddy_free[order], idx);
+                buddy_free_count[order]--;
+
+                if (block_start < start) buddy_insert_range(block_start, start);
+                if (block_end > end) buddy_insert_range(end, block_end);
+
+                next = block_end;
+                break;
+            }
+        }
+
+        if (next >= end) break;
+        frame = sbm_find(&frame_bitmap, next);
+    }
+}
+
+// ----------------- Zones -----------------
+
+static inline zone_t *frame_zone(uint32_t frame) {
+    if (frame >= zones[PMM_ZONE_HIGH].start) return &zones[PMM_ZONE_HIGH];
+    if (frame >= zones[PMM_ZONE_DIRECT].start) return &zones[PMM_ZONE_DIRECT];
+    return &zones[PMM_ZONE_DMA];
+}
+
+static void zone_reset(void) {
+    for (int z = 0; z < PMM_ZONE_COUNT; z++) {
+        zones[z].present = 0;
+        zones[z].free = 0;
+        zones[z].hint = zones[z].start;
+        zones[z].zero_list = 0;
+        zones[z].zero_count = 0;
+    }
+    zero_pool_hits = 0;
+    zero_pool_misses = 0;
+    free_cache_count = 0;
+}
+
+// Lowest free frame inside the zone, or NO_FRAME
+static uint32_t zone_find_frame(zone_t *zone) {
+    if (zone->free == 0) {
+        return NO_FRAME;
+    }
+
+    uint32_t frame = sbm_find(&frame_bitmap, zone->hint);
+    if (frame == NO_FRAME || frame >= zone->end) {
+        zone->hint = zone->end;
+        return NO_FRAME;
+    }
+
+    return frame;
+}
+
+// First free buddy block of exactly 'order' inside the zone, or NO_FRAME
+static uint32_t zone_find_block(zone_t *zone, uint32_t order) {
+    if (buddy_free_count[order] == 0 || zone->free < (1u << order)) {
+        return NO_FRAME;
+    }
+
+    uint32_t idx = sbm_find(&buddy_free[order], zone->start >> order);
+    if (idx == NO_FRAME || (idx << order) >= zone->end) {
+        return NO_FRAME;
+    }
+
+    return idx;
+}
+
+// ----------------- Frame state -----------------
+
+// Take a free frame out of the bitmap and buddy index
+static void frame_take(uint32_t frame) {
+    if (!frame_is_used(frame)) {
+        sbm_clear(&frame_bitmap, frame);
+        buddy_carve(frame);
+        frame_zone(frame)->free--;
         used_frames++;
     }
 }
 
-void pmm_mark_free(uint32_t frame) {
-    if (frame >= MAX_FRAMES) return;
-    
-    if (test_bit(frame)) {
-        clear_bit(frame);
+// Give a used frame back to the bitmap and buddy index
+static void frame_release(uint32_t frame) {
+    if (frame_is_used(frame)) {
+        zone_t *zone = frame_zone(frame);
+
+        sbm_set(&frame_bitmap, frame);
+        buddy_insert(frame, 0);
+        zone->free++;
         used_frames--;
+
+        if (frame < zone->hint) {
+            zone->hint = frame;
+        }
     }
 }
 
-void *pmm_alloc_frame(void) {
-    //Finding first free frame
-    for (uint32_t i = 0; i < MAX_FRAMES; i++) {
-        if (!test_bit(i)) {
-            pmm_mark_used(i);
-            return (void*)(i * FRAME_SIZE);
+// Give a whole block back at once, or frame by frame if part of it is
+// already free
+static void block_release(uint32_t frame, uint32_t order) {
+    uint32_t count = 1u << order;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!frame_is_used(frame + i)) {
+            klogf("[pmm] WARNING: Block 0x%08x (order %u) partially free\n",
+                  frame * FRAME_SIZE, order);
+            for (uint32_t j = 0; j < count; j++) {
+                frame_release(frame + j);
+            }
+            return;
         }
     }
+
+    zone_t *zone = frame_zone(frame);
+
+    for (uint32_t i = 0; i < count; i++) {
+        sbm_set(&frame_bitmap, frame + i);
+    }
+    buddy_insert(frame, order);
+    zone->free += count;
+    used_frames -= count;
+
+    if (frame < zone->hint) {
+        zone->hint = frame;
+    }
+}
+
+// Fresh descriptor for a newly allocated frame or block
+static inline void page_reset(page_t *page, uint16_t refcount, uint8_t flags, uint8_t order) {
+    page->refcount = refcount;
+    page->flags = flags;
+    page->order = order;
+    page->owner = NULL;
+    page->lru_next = 0;
+    page->lru_prev = 0;
+}
+
+// Pooled frames are taken out of the bitmap but still count as free; they
+// are chained through page_t.lru_next
+static void zero_pool_push(zone_t *zone, uint32_t frame) {
+    page_reset(&pages[frame], 0, PG_ZERO, 0);
+    pages[frame].lru_next = zone->zero_list;
+    zone->zero_list = frame;
+    zone->zero_count++;
+    used_frames--;
+}
+
+static uint32_t zero_pool_pop(zone_t *zone) {
+    uint32_t frame = zone->zero_list;
+
+    if (zone->zero_count == 0) {
+        return NO_FRAME;
+    }
+
+    zone->zero_list = pages[frame].lru_next;
+    zone->zero_count--;
+    used_frames++;
+    return frame;
+}
+
+static bool free_cache_push(uint32_t frame) {
+    if (free_cache_count == FREE_CACHE_SIZE || frame < zones[PMM_ZONE_HIGH].start) {
+        return false;
+    }
+
+    free_cache[free_cache_count++] = frame;
+    used_frames--;
+    return true;
+}
+
+static uint32_t free_cache_pop(void) {
+    if (free_cache_count == 0) {
+        return NO_FRAME;
+    }
+
+    used_frames++;
+    return free_cache[--free_cache_count];
+}
+
+// Hand every cached frame back to the bitmap so it can coalesce again
+static void free_cache_drain(void) {
+    while (free_cache_count > 0) {
+        frame_release(free_cache_pop());
+    }
+}
+
+// Hand the zeroed pools of zone and the zones below back to the bitmap.
+// Pooled frames split free blocks just like cached ones. True if any were
+// pooled.
+static bool zero_pool_drain(pmm_zone_t zone) {
+    bool drained = false;
+
+    for (int z = (int)zone; z >= 0; z--) {
+        uint32_t frame;
+        while ((frame = zero_pool_pop(&zones[z])) != NO_FRAME) {
+            page_reset(&pages[frame], 0, 0, 0);
+            frame_release(frame);
+            drained = true;
+        }
+    }
+
+    return drained;
+}
+
+// Ask the hooks for frames, true if any of them released something
+static bool pmm_reclaim(void) {
+    for (uint32_t i = 0; i < reclaim_hook_count; i++) {
+        if (reclaim_hooks[i]()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int pmm_register_reclaim(pmm_reclaim_t fn) {
+    if (!fn || reclaim_hook_count >= MAX_RECLAIM_HOOKS) {
+        return -1;
+    }
+
+    reclaim_hooks[reclaim_hook_count++] = fn;
+    return 0;
+}
+
+void pmm_mark_used(uint32_t frame) {
+    if (frame >= max_frames) return;
     
-    // Out of memory (still bad for the economy)
+    frame_take(frame);
+    page_reset(&pages[frame], 0, PG_RESERVED, 0);
+}
+
+void pmm_mark_free(uint32_t frame) {
+    if (frame >= max_frames) return;
+    
+    frame_release(frame);
+    page_reset(&pages[frame], 0, 0, 0);
+}
+
+void *pmm_alloc_frame_zone(pmm_zone_t zone) {
+    if (zone >= PMM_ZONE_COUNT) {
+        zone = PMM_ZONE_HIGH;
+    }
+
+    if (zone == PMM_ZONE_HIGH && free_cache_count > 0) {
+        uint32_t frame = free_cache_pop();
+        page_reset(&pages[frame], 1, 0, 0);
+        return (void*)(frame * FRAME_SIZE);
+    }
+
+    // Fall back towards the scarcer low zones only when the preferred one is empty
+    for (int z = (int)zone; z >= 0; z--) {
+        uint32_t frame = zone_find_frame(&zones[z]);
+        if (frame == NO_FRAME) continue;
+
+        frame_take(frame);
+        page_reset(&pages[frame], 1, 0, 0);
+        zones[z].hint = frame + 1;
+        return (void*)(frame * FRAME_SIZE);
+    }
+
+    // Zeroed frames are still free frames, don't fail while some are pooled
+    for (int z = (int)zone; z >= 0; z--) {
+        uint32_t frame = zero_pool_pop(&zones[z]);
+        if (frame == NO_FRAME) continue;
+
+        page_reset(&pages[frame], 1, 0, 0);
+        return (void*)(frame * FRAME_SIZE);
+    }
+
+    // Out of memory (still bad for the economy), unless a cache lets go
+    if (pmm_reclaim()) {
+        return pmm_alloc_frame_zone(zone);
+    }
+
     return NULL;
 }
 
+void *pmm_alloc_frame(void) {
+    return pmm_alloc_frame_zone(PMM_ZONE_HIGH);
+}
+
 void pmm_free_frame(void *phys_addr) {
+    page_t *page = pmm_phys_to_page(phys_addr);
+
+    if (!page) {
+        klogf("[pmm] ERROR: Free of untracked frame 0x%08x\n", (uint32_t)phys_addr);
+        return;
+    }
+
+    page_put(page);
+}
+
+void *pmm_alloc_frames_zone(uint32_t order, pmm_zone_t zone) {
+    if (order > PMM_MAX_ORDER) {
+        klogf("[pmm] ERROR: Order %u too large (max %u)\n", order, PMM_MAX_ORDER);
+        return NULL;
+    }
+
+    if (zone >= PMM_ZONE_COUNT) {
+        zone = PMM_ZONE_HIGH;
+    }
+
+    for (int z = (int)zone; z >= 0; z--) {
+        // Smallest free block in this zone that satisfies the request
+        uint32_t found = order;
+        uint32_t idx = NO_FRAME;
+        for (; found <= PMM_MAX_ORDER; found++) {
+            idx = zone_find_block(&zones[z], found);
+            if (idx != NO_FRAME) break;
+        }
+
+        if (idx == NO_FRAME) continue;
+
+        uint32_t frame = idx << found;
+        sbm_clear(&buddy_free[found], idx);
+        buddy_free_count[found]--;
+        buddy_split(frame, found, order);
+
+        uint32_t count = 1u << order;
+        for (uint32_t i = 0; i < count; i++) {
+            sbm_clear(&frame_bitmap, frame + i);
+        }
+        zones[z].free -= count;
+        used_frames += count;
+
+        // The head descriptor speaks for the whole block
+        page_reset(&pages[frame], 1, PG_HEAD, (uint8_t)order);
+
+        return (void*)(frame * FRAME_SIZE);
+    }
+
+    // Cached frames may be all that keeps a block from coalescing
+    if (free_cache_count > 0) {
+        free_cache_drain();
+        return pmm_alloc_frames_zone(order, zone);
+    }
+
+    // So may pooled zeroed frames, the idle loop refills the pools later
+    if (zero_pool_drain(zone)) {
+        return pmm_alloc_frames_zone(order, zone);
+    }
+
+    if (pmm_reclaim()) {
+        return pmm_alloc_frames_zone(order, zone);
+    }
+
+    return NULL;
+}
+
+void *pmm_alloc_frames(uint32_t order) {
+    return pmm_alloc_frames_zone(order, PMM_ZONE_HIGH);
+}
+
+void pmm_free_frames(void *phys_addr, uint32_t order) {
     uint32_t frame = (uint32_t)phys_addr / FRAME_SIZE;
-    pmm_mark_free(frame);
+    uint32_t count = 1u << order;
+
+    if (order > PMM_MAX_ORDER || (frame & (count - 1)) || frame + count > max_frames) {
+        klogf("[pmm] ERROR: Bad block free 0x%08x (order %u)\n", (uint32_t)phys_addr, order);
+        return;
+    }
+
+    if (pages[frame].order != order) {
+        klogf("[pmm] ERROR: Block 0x%08x freed as order %u, allocated as order %u\n",
+              (uint32_t)phys_addr, order, pages[frame].order);
+        return;
+    }
+
+    page_put(&pages[frame]);
+}
+
+// ----------------- Zeroed frame pool -----------------
+
+void *pmm_alloc_zeroed_frame_zone(pmm_zone_t zone) {
+    if (zone >= PMM_ZONE_COUNT) {
+        zone = PMM_ZONE_HIGH;
+    }
+
+    uint32_t frame = zero_pool_pop(&zones[zone]);
+    if (frame != NO_FRAME) {
+        zero_pool_hits++;
+        page_reset(&pages[frame], 1, 0, 0);
+        return (void*)(frame * FRAME_SIZE);
+    }
+
+    // Pool ran dry, pay for the memset here
+    zero_pool_misses++;
+
+    void *phys = pmm_alloc_frame_zone(zone);
+    if (phys) {
+        vmm_zero_frame((uint32_t)phys);
+    }
+    return phys;
+}
+
+void *pmm_alloc_zeroed_frame(void) {
+    return pmm_alloc_zeroed_frame_zone(PMM_ZONE_HIGH);
+}
+
+bool pmm_zero_pool_refill(void) {
+    for (int z = PMM_ZONE_COUNT - 1; z >= 0; z--) {
+        zone_t *zone = &zones[z];
+
+        // Full, or memory is tight enough that real allocations need it more
+        if (zone->zero_count >= zone->zero_target || zone->free <= 2 * zone->zero_target) {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < ZERO_POOL_BATCH && zone->zero_count < zone->zero_target; i++) {
+            uint32_t frame = zone_find_frame(zone);
+            if (frame == NO_FRAME) break;
+
+            frame_take(frame);
+            zone->hint = frame + 1;
+            vmm_zero_frame(frame * FRAME_SIZE);
+            zero_pool_push(zone, frame);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+// ----------------- Batches -----------------
+
+// Take up to count free frames from one zone in a single forward pass
+// over its bitmap
+static uint32_t zone_take_batch(zone_t *zone, uint32_t count, void **frames) {
+    uint32_t got = 0;
+    uint32_t frame = zone_find_frame(zone);
+
+    while (got < count && frame != NO_FRAME && frame < zone->end) {
+        frame_take(frame);
+        page_reset(&pages[frame], 1, 0, 0);
+        frames[got++] = (void*)(frame * FRAME_SIZE);
+        zone->hint = frame + 1;
+
+        frame = sbm_find(&frame_bitmap, frame + 1);
+    }
+
+    return got;
+}
+
+int pmm_alloc_batch(uint32_t count, void **frames) {
+    uint32_t got = 0;
+
+    // Recently freed frames first, they're likely still in the CPU cache
+    while (got < count && free_cache_count > 0) {
+        uint32_t frame = free_cache_pop();
+        page_reset(&pages[frame], 1, 0, 0);
+        frames[got++] = (void*)(frame * FRAME_SIZE);
+    }
+
+    for (int z = PMM_ZONE_HIGH; z >= 0 && got < count; z--) {
+        got += zone_take_batch(&zones[z], count - got, frames + got);
+    }
+
+    for (int z = PMM_ZONE_HIGH; z >= 0 && got < count; z--) {
+        uint32_t frame;
+        while (got < count && (frame = zero_pool_pop(&zones[z])) != NO_FRAME) {
+            page_reset(&pages[frame], 1, 0, 0);
+            frames[got++] = (void*)(frame * FRAME_SIZE);
+        }
+    }
+
+    // Whatever a cache gives back goes towards the rest
+    if (got < count && pmm_reclaim() && pmm_alloc_batch(count - got, frames + got) == 0) {
+        return 0;
+    }
+
+    if (got < count) {
+        pmm_free_batch(got, frames);
+        return -1;
+    }
+
+    return 0;
+}
+
+int pmm_alloc_zeroed_batch(uint32_t count, void **frames) {
+    zone_t *zone = &zones[PMM_ZONE_HIGH];
+    uint32_t got = 0;
+
+    while (got < count && zone->zero_count > 0) {
+        uint32_t frame = zero_pool_pop(zone);
+        page_reset(&pages[frame], 1, 0, 0);
+        frames[got++] = (void*)(frame * FRAME_SIZE);
+        zero_pool_hits++;
+    }
+
+    if (got == count) {
+        return 0;
+    }
+
+    if (pmm_alloc_batch(count - got, frames + got) < 0) {
+        pmm_free_batch(got, frames);
+        return -1;
+    }
+
+    for (uint32_t i = got; i < count; i++) {
+        vmm_zero_frame((uint32_t)frames[i]);
+    }
+    zero_pool_misses += count - got;
+
+    return 0;
+}
+
+void pmm_free_batch(uint32_t count, void **frames) {
+    for (uint32_t i = 0; i < count; i++) {
+        pmm_free_frame(frames[i]);
+    }
+}
+
+// ----------------- Frame descriptors -----------------
+
+page_t *pmm_phys_to_page(void *phys_addr) {
+    uint32_t frame = (uint32_t)phys_addr / FRAME_SIZE;
+
+    if (frame >= max_frames) return NULL;
+    return &pages[frame];
+}
+
+void *pmm_page_to_phys(page_t *page) {
+    return (void*)((uint32_t)(page - pages) * FRAME_SIZE);
+}
+
+void page_get(page_t *page) {
+    if (page->refcount == 0) {
+        klogf("[pmm] WARNING: page_get() on unowned frame 0x%08x\n",
+              (uint32_t)pmm_page_to_phys(page));
+        return;
+    }
+
+    if (page->refcount == UINT16_MAX) {
+        panicf("[pmm] Reference count overflow on frame 0x%08x",
+               (uint32_t)pmm_page_to_phys(page));
+    }
+
+    page->refcount++;
+}
+
+void page_put(page_t *page) {
+    if (page->flags & PG_RESERVED) {
+        return;
+    }
+
+    if (page->refcount == 0) {
+        klogf("[pmm] WARNING: Double free of frame 0x%08x\n",
+              (uint32_t)pmm_page_to_phys(page));
+        return;
+    }
+
+    if (--page->refcount > 0) {
+        return;
+    }
+
+    uint32_t frame = (uint32_t)(page - pages);
+    uint32_t order = page->order;
+
+    page_reset(page, 0, 0, 0);
+    if (order) {
+        block_release(frame, order);
+    } else if (!free_cache_push(frame)) {
+        frame_release(frame);
+    }
+}
+
+// Range updates are applied one zone at a time so each zone's free count
+// stays exact
+static void mark_range(uint32_t start, uint32_t end, bool free) {
+    if (end > max_frames) end = max_frames;
+
+    while (start < end) {
+        zone_t *zone = frame_zone(start);
+        uint32_t stop = (end < zone->end) ? end : zone->end;
+        uint32_t were_free = sbm_count(&frame_bitmap, start, stop);
+
+        buddy_remove_range(start, stop);
+
+        if (free) {
+            sbm_fill(&frame_bitmap, start, stop, true);
+            buddy_insert_range(start, stop);
+
+            uint32_t freed = (stop - start) - were_free;
+            zone->free += freed;
+            used_frames -= freed;
+
+            if (start < zone->hint) {
+                zone->hint = start;
+            }
+        } else {
+            sbm_fill(&frame_bitmap, start, stop, false);
+            zone->free -= were_free;
+            used_frames += were_free;
+        }
+
+        start = stop;
+    }
+}
+
+// Descriptors follow the bitmap: reserved frames are pinned, freed ones
+// forget any owner
+static void mark_pages(uint32_t start, uint32_t end, uint8_t flags) {
+    if (end > max_frames) end = max_frames;
+
+    for (uint32_t frame = start; frame < end; frame++) {
+        page_reset(&pages[frame], 0, flags, 0);
+    }
+}
+
+void pmm_mark_range_used(uint32_t start, uint32_t end) {
+    mark_range(start, end, false);
+    mark_pages(start, end, PG_RESERVED);
+}
+
+void pmm_mark_range_free(uint32_t start, uint32_t end) {
+    mark_range(start, end, true);
+    mark_pages(start, end, 0);
+}
+
+// ----------------- Boot-time setup -----------------
+
+static inline multiboot_mmap_entry_t *mmap_next(multiboot_mmap_entry_t *entry) {
+    return (multiboot_mmap_entry_t*)((uintptr_t)entry + entry->size + sizeof(entry->size));
+}
+
+// Remember a byte range as reserved, widened to whole frames
+static void boot_range_add(const char *name, uint32_t start, uint32_t end) {
+    start &= ~(FRAME_SIZE - 1);
+    end = (end + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+
+    if (start >= end || boot_range_count >= MAX_BOOT_RANGES) return;
+
+    boot_ranges[boot_range_count].name = name;
+    boot_ranges[boot_range_count].start = start;
+    boot_ranges[boot_range_count].end = end;
+    boot_range_count++;
+}
+
+// Boot-time bump allocator: the first size bytes at or past from that lie
+// inside one available region, miss every boot range and end below
+// DIRECT_MAP_LIMIT (so they are reachable through the direct map).
+// Returns 0 if nothing fits.
+static uint32_t early_alloc(multiboot_info_t *mb, uint32_t from, uint32_t size) {
+    multiboot_mmap_entry_t *first = (multiboot_mmap_entry_t*)PHYS_TO_VIRT(mb->mmap_addr);
+    uintptr_t mmap_end = (uintptr_t)first + mb->mmap_length;
+    uint32_t addr = (from + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+
+    while (addr < DIRECT_MAP_LIMIT && size <= DIRECT_MAP_LIMIT - addr) {
+        uint32_t end = addr + size;
+        uint32_t next = DIRECT_MAP_LIMIT;
+        bool inside = false;
+
+        for (multiboot_mmap_entry_t *e = first; (uintptr_t)e < mmap_end; e = mmap_next(e)) {
+            if (e->type != 1) continue;
+
+            if (e->addr <= addr && e->addr + e->length >= end) {
+                inside = true;
+                break;
+            }
+            if (e->addr > addr && e->addr < next) {
+                next = (uint32_t)e->addr;
+            }
+        }
+
+        if (inside) next = 0;
+
+        for (uint32_t i = 0; i < boot_range_count; i++) {
+            boot_range_t *r = &boot_ranges[i];
+            if (r->start < end && addr < r->end && r->end > next) {
+                next = r->end;
+            }
+        }
+
+        if (next == 0) return addr;
+        addr = (next + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+    }
+
+    return 0;
+}
+
+// Bytes of descriptors, frame bitmap and buddy index needed to track frames
+static uint32_t metadata_size(uint32_t frames) {
+    uint32_t words = sbm_words(frames);
+
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        words += sbm_words(frames >> order);
+    }
+
+    return frames * sizeof(page_t) + words * sizeof(uint32_t);
 }
 
 void pmm_init(void *mboot_ptr) {
@@ -69,10 +1053,10 @@ void pmm_init(void *mboot_ptr) {
     
     klogf("[pmm] Initializing Physical Memory Manager...\n");
     
-    // Mark all frames as used initially
-    memset(frame_bitmap, 0xFF, BITMAP_SIZE);
     total_frames = 0;
     used_frames = 0;
+    max_frames = 0;
+    zone_reset();
     
     // Check for memory map
     if (!(mb->flags & MB_INFO_MMAP)) {
@@ -80,10 +1064,76 @@ void pmm_init(void *mboot_ptr) {
         return;
     }
     
-    // Parse multiboot memory map
-    multiboot_mmap_entry_t *mmap = (multiboot_mmap_entry_t*)(uintptr_t)mb->mmap_addr;
-    uint32_t mmap_end = mb->mmap_addr + mb->mmap_length;
+    multiboot_mmap_entry_t *mmap = (multiboot_mmap_entry_t*)PHYS_TO_VIRT(mb->mmap_addr);
+    uint32_t mmap_end = (uint32_t)mmap + mb->mmap_length;
     
+    // Everything the linker and bootloader already put in RAM (the linker
+    // symbols are direct map addresses)
+    extern uint8_t kernel_start[], kernel_end[];
+    extern uint8_t initramfs_start[], initramfs_end[];
+    uint32_t kernel_end_phys = VIRT_TO_PHYS(kernel_end);
+    
+    boot_range_count = 0;
+    boot_range_add("kernel", VIRT_TO_PHYS(kernel_start), kernel_end_phys);
+    boot_range_add("initramfs", VIRT_TO_PHYS(initramfs_start), VIRT_TO_PHYS(initramfs_end));
+    boot_range_add("multiboot info", VIRT_TO_PHYS(mb), VIRT_TO_PHYS(mb) + sizeof(multiboot_info_t));
+    boot_range_add("memory map", mb->mmap_addr, mb->mmap_addr + mb->mmap_length);
+    
+    // Size the metadata for the highest usable frame, rounded up to whole
+    // max order blocks so no buddy block hangs off the end
+    uint32_t highest = 0;
+    for (multiboot_mmap_entry_t *e = mmap; (uint32_t)e < mmap_end; e = mmap_next(e)) {
+        if (e->type != 1 || e->addr >= (uint64_t)PMM_FRAME_LIMIT * FRAME_SIZE) continue;
+        
+        uint64_t last = (e->addr + e->length) / FRAME_SIZE;
+        if (last > PMM_FRAME_LIMIT) last = PMM_FRAME_LIMIT;
+        if (last > highest) highest = (uint32_t)last;
+    }
+    
+    max_frames = (highest + BUDDY_FRAMES - 1) & ~(BUDDY_FRAMES - 1);
+    if (max_frames < DIRECT_MAP_LIMIT / FRAME_SIZE) {
+        max_frames = DIRECT_MAP_LIMIT / FRAME_SIZE;
+    }
+    
+    uint32_t meta_size = metadata_size(max_frames);
+    uint32_t meta_addr = early_alloc(mb, kernel_end_phys, meta_size);
+    
+    // Not enough direct mapped RAM to track everything, give up the top
+    // half until it fits
+    while (!meta_addr && max_frames > DIRECT_MAP_LIMIT / FRAME_SIZE) {
+        max_frames = (max_frames / 2) & ~(BUDDY_FRAMES - 1);
+        if (max_frames < DIRECT_MAP_LIMIT / FRAME_SIZE) {
+            max_frames = DIRECT_MAP_LIMIT / FRAME_SIZE;
+        }
+        
+        meta_size = metadata_size(max_frames);
+        meta_addr = early_alloc(mb, kernel_end_phys, meta_size);
+    }
+    
+    if (!meta_addr) {
+        panicf("[pmm] No room for %u KiB of frame metadata", meta_size / 1024);
+    }
+    
+    if (max_frames < highest) {
+        klogf("[pmm] WARNING: Only tracking the first %u MB of RAM\n",
+              max_frames / (1024 * 1024 / FRAME_SIZE));
+    }
+    
+    // Descriptors go first so the array starts page (and cache line) aligned
+    pages = (page_t*)PHYS_TO_VIRT(meta_addr);
+    memset(pages, 0, max_frames * sizeof(page_t));
+    
+    uint32_t *pool = (uint32_t*)(pages + max_frames);
+    pool = sbm_setup(&frame_bitmap, max_frames, pool);
+    buddy_init(pool);
+    zones[PMM_ZONE_HIGH].end = max_frames;
+    
+    boot_range_add("PMM metadata", meta_addr, meta_addr + meta_size);
+    klogf("[pmm] Metadata: %u KiB at 0x%08x for %u frames\n",
+          meta_size / 1024, meta_addr, max_frames);
+    
+    // Parse multiboot memory map, every frame starts out used. The
+    // descriptors are already zeroed, so only the bitmaps need filling.
     klogf("[pmm] Parsing memory map...\n");
     
     while ((uint32_t)mmap < mmap_end) {
@@ -95,15 +1145,16 @@ void pmm_init(void *mboot_ptr) {
                   (uint32_t)start, (uint32_t)end, 
                   (uint32_t)(mmap->length / 1024));
             
-            // Mark frames in this region as free
-            for (uint64_t addr = start; addr < end; addr += FRAME_SIZE) {
-                uint32_t frame = addr / FRAME_SIZE;
-                if (frame < MAX_FRAMES) {
-                    if (total_frames < frame + 1) {
-                        total_frames = frame + 1;
-                    }
-                    pmm_mark_free(frame);
+            // Only whole frames inside the region are usable
+            uint64_t first = (start + FRAME_SIZE - 1) / FRAME_SIZE;
+            uint64_t last = end / FRAME_SIZE;
+            if (last > max_frames) last = max_frames;
+            
+            if (first < last) {
+                if (total_frames < last) {
+                    total_frames = (uint32_t)last;
                 }
+                mark_range((uint32_t)first, (uint32_t)last, true);
             }
         } else {
             klogf("[pmm] Reserved: 0x%08x - 0x%08x (type %u)\n",
@@ -112,46 +1163,32 @@ void pmm_init(void *mboot_ptr) {
                   (uint32_t)mmap->type);
         }
         
-        // Move to next entry (variable size)
-        mmap = (multiboot_mmap_entry_t*)((uint32_t)mmap + mmap->size + sizeof(mmap->size));
-    }
-    
-    // Reserve kernel memory
-    extern uint8_t kernel_start[], kernel_end[];
-    uint32_t kernel_start_addr = (uint32_t)kernel_start;
-    uint32_t kernel_end_addr = (uint32_t)kernel_end;
-    
-    // Align kernel end up to next frame
-    kernel_end_addr = (kernel_end_addr + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
-    
-    klogf("[pmm] Reserving kernel: 0x%08x - 0x%08x (%u KiB)\n",
-          kernel_start_addr, kernel_end_addr,
-          (kernel_end_addr - kernel_start_addr) / 1024);
-    
-    for (uint32_t addr = kernel_start_addr; addr < kernel_end_addr; addr += FRAME_SIZE) {
-        pmm_mark_used(addr / FRAME_SIZE);
+        mmap = mmap_next(mmap);
     }
     
-    // Reserve multiboot info structure
-    uint32_t mb_start = (uint32_t)mb & ~(FRAME_SIZE - 1);
-    uint32_t mb_end = ((uint32_t)mb + sizeof(multiboot_info_t) + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
-    
-    klogf("[pmm] Reserving multiboot info: 0x%08x - 0x%08x\n", mb_start, mb_end);
-    for (uint32_t addr = mb_start; addr < mb_end; addr += FRAME_SIZE) {
-        pmm_mark_used(addr / FRAME_SIZE);
+    // Everything below total_frames that the map did not hand us is in use
+    // (holes, ROM, MMIO), so the running count starts from there
+    uint32_t free_frames = 0;
+    for (int z = 0; z < PMM_ZONE_COUNT; z++) {
+        zones[z].present = zones[z].free;
+        free_frames += zones[z].free;
+        klogf("[pmm] Zone %s: 0x%08x - 0x%08x, %u usable frames\n",
+              zones[z].name, zones[z].start * FRAME_SIZE,
+              zones[z].end * FRAME_SIZE, zones[z].present);
     }
+    used_frames = total_frames - free_frames;
     
-    // Reserve memory map itself
-    if (mb->flags & MB_INFO_MMAP) {
-        uint32_t mmap_start = mb->mmap_addr & ~(FRAME_SIZE - 1);
-        uint32_t mmap_end_addr = (mb->mmap_addr + mb->mmap_length + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+    for (uint32_t i = 0; i < boot_range_count; i++) {
+        boot_range_t *r = &boot_ranges[i];
         
-        klogf("[pmm] Reserving memory map: 0x%08x - 0x%08x\n", mmap_start, mmap_end_addr);
-        for (uint32_t addr = mmap_start; addr < mmap_end_addr; addr += FRAME_SIZE) {
-            pmm_mark_used(addr / FRAME_SIZE);
-        }
+        klogf("[pmm] Reserving %s: 0x%08x - 0x%08x (%u KiB)\n",
+              r->name, r->start, r->end, (r->end - r->start) / 1024);
+        pmm_mark_range_used(r->start / FRAME_SIZE, r->end / FRAME_SIZE);
     }
     
+    // Frame 0 is never handed out, a NULL return means out of memory
+    pmm_mark_used(0);
+    
     klogf("[pmm] Initialization complete\n");
 }
 
@@ -169,13 +1206,7 @@ uint32_t pmm_get_used_frames(void) {
 
 // Now available in MB and KB! Yay!
 void pmm_dump_stats(void) {
-    uint32_t actual_used = 0;
-    for (uint32_t i = 0; i < total_frames; i++) {
-        if (test_bit(i)) {
-            actual_used++;
-        }
-    }
-    
+    uint32_t actual_used = used_frames;
     uint32_t actual_free = total_frames - actual_used;
     
     uint32_t total_kb = (total_frames * FRAME_SIZE) / 1024;
@@ -189,5 +1220,21 @@ void pmm_dump_stats(void) {
           actual_used, used_kb, used_kb / 1024);
     klogf("[pmm] Free:  %u frames (%u KB | %u MB)\n", 
           actual_free, free_kb, free_kb / 1024);
+    for (int z = 0; z < PMM_ZONE_COUNT; z++) {
+        klogf("[pmm] Zone %s: %u of %u frames free\n",
+              zones[z].name, zones[z].free, zones[z].present);
+    }
+    for (int z = 0; z < PMM_ZONE_COUNT; z++) {
+        if (zones[z].zero_target == 0) continue;
+        klogf("[pmm] Zeroed pool %s: %u of %u frames\n",
+              zones[z].name, zones[z].zero_count, zones[z].zero_target);
+    }
+    klogf("[pmm] Zeroed pool hits: %u, misses: %u\n", zero_pool_hits, zero_pool_misses);
+    klogf("[pmm] Free frame cache: %u of %u frames\n", free_cache_count, FREE_CACHE_SIZE);
+    klogf("[pmm] Free blocks by order:\n");
+    for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+        klogf("[pmm]   order %u (%u KB): %u\n",
+              order, (FRAME_SIZE << order) / 1024, buddy_free_count[order]);
+    }
     klogf("[pmm] ==============================\n");
 }
\ No newline at end of file
@@ -18,6 +18,73 @@
 /** @brief Size of a single physical frame in bytes (4KB) */
 #define FRAME_SIZE 4096
 
+/** @brief Largest buddy block order (2^10 frames = 4MB) */
+#define PMM_MAX_ORDER 10
+
+/** @brief End of the DMA zone: ISA DMA can only reach the first 16MB */
+#define PMM_DMA_LIMIT (16 * 1024 * 1024)
+
+/**
+ * @brief Physical memory zones
+ * 
+ * Frames are grouped by what they can be used for. An allocation asks for
+ * the highest zone it can live with and falls back to lower (scarcer)
+ * zones only when that zone is exhausted:
+ * HIGH -> DIRECT -> DMA.
+ */
+typedef enum {
+    PMM_ZONE_DMA = 0,   /**< Below PMM_DMA_LIMIT, reachable by ISA DMA */
+    PMM_ZONE_DIRECT,    /**< Below DIRECT_MAP_LIMIT, always mapped at PHYS_TO_VIRT() */
+    PMM_ZONE_HIGH,      /**< Everything else, only reachable through a mapping */
+    PMM_ZONE_COUNT
+} pmm_zone_t;
+
+/** @brief Frame is reserved (kernel image, boot data, holes), never freed */
+#define PG_RESERVED  (1 << 0)
+
+/** @brief Frame is the first of a block from pmm_alloc_frames() */
+#define PG_HEAD      (1 << 1)
+
+/** @brief Frame sits in a zeroed frame pool */
+#define PG_ZERO      (1 << 2)
+
+/** @brief Block is a slab, owner points at its kmem_cache */
+#define PG_SLAB      (1 << 3)
+
+/**
+ * @brief Per-frame descriptor
+ * 
+ * The PMM keeps one of these for every frame it tracks, indexed by frame
+ * number and allocated by pmm_init() next to the frame bitmap. A frame
+ * stays allocated for as long as its reference count is non-zero, which
+ * is what lets several mappings share one frame.
+ * 
+ * Kept at 16 bytes so four descriptors share a cache line and a lookup
+ * touches exactly one. For a block, only the head descriptor is used.
+ * 
+ * The LRU links hold frame numbers rather than pointers to keep the
+ * struct small. Frame 0 is never handed out, so 0 means "no link".
+ */
+typedef struct page {
+    uint16_t refcount;  /**< Holders of this frame, 0 = free or reserved */
+    uint8_t flags;      /**< PG_* flags */
+    uint8_t order;      /**< Block order (valid on PG_HEAD frames) */
+    void *owner;        /**< Whoever manages the contents (slab, file, ...) */
+    uint32_t lru_next;  /**< Next frame on an LRU / owner list */
+    uint32_t lru_prev;  /**< Previous frame on an LRU / owner list */
+} page_t;
+
+/**
+ * @brief Memory reclaim hook
+ * 
+ * Gives some frames back (drops a cache, ...) when an allocation would
+ * otherwise fail. Runs in the middle of a PMM allocation, so it may free
+ * frames but must not allocate anything, from the PMM or the heap.
+ * 
+ * @return true if anything was released, false if there is nothing left
+ */
+typedef bool (*pmm_reclaim_t)(void);
+
 /**
  * @brief Initialize the physical memory manager
  * 
@@ -25,7 +92,7 @@
  * memory regions and sets up the frame bitmap for tracking allocation.
  * Must be called early in the boot process before any memory allocation.
  * 
- * @param mboot_info Pointer to multiboot information structure
+ * @param mboot_info Multiboot information structure (direct map address)
  */
 void pmm_init(void *mboot_info);
 
@@ -34,23 +101,167 @@ void pmm_init(void *mboot_info);
  * 
  * Finds and allocates one 4KB physical memory frame from the pool
  * of available frames. The frame is marked as used in the bitmap.
+ * Same as pmm_alloc_frame_zone(PMM_ZONE_HIGH).
  * 
  * @return Physical address of the allocated frame, or NULL if out of memory
  * @warning Returned address is PHYSICAL, not virtual
  */
 void* pmm_alloc_frame(void);
 
+/**
+ * @brief Allocate a single physical frame from a zone
+ * 
+ * Takes a frame from the requested zone, falling back to lower zones
+ * if it is empty. Kernel structures that must be reachable through the
+ * direct map (slabs, scratch arenas) ask for PMM_ZONE_DIRECT,
+ * DMA buffers ask for PMM_ZONE_DMA.
+ * 
+ * @param zone Highest zone the frame may come from
+ * @return Physical address of the allocated frame, or NULL if out of memory
+ * @warning Returned address is PHYSICAL, not virtual
+ */
+void* pmm_alloc_frame_zone(pmm_zone_t zone);
+
+/**
+ * @brief Allocate a single zero-filled physical frame
+ * 
+ * Same as pmm_alloc_zeroed_frame_zone(PMM_ZONE_HIGH).
+ * 
+ * @return Physical address of the allocated frame, or NULL if out of memory
+ * @warning Returned address is PHYSICAL, not virtual
+ */
+void* pmm_alloc_zeroed_frame(void);
+
+/**
+ * @brief Allocate a single zero-filled physical frame from a zone
+ * 
+ * Hands out a frame from the zone's pool of pre-zeroed frames, so page
+ * tables, BSS and fresh user pages skip the memset. If the pool is empty
+ * the frame is allocated as usual and zeroed on the spot. Hits and misses
+ * are counted in pmm_dump_stats().
+ * 
+ * @param zone Highest zone the frame may come from
+ * @return Physical address of the allocated frame, or NULL if out of memory
+ * @warning Returned address is PHYSICAL, not virtual
+ */
+void* pmm_alloc_zeroed_frame_zone(pmm_zone_t zone);
+
+/**
+ * @brief Allocate several frames at once
+ * 
+ * Fills frames[] with count single frames (not contiguous), preferring
+ * recently freed ones, then HIGH, DIRECT and DMA like pmm_alloc_frame().
+ * Fresh frames come from one forward pass over the bitmap instead of a
+ * lookup per frame. All or nothing: on failure nothing stays allocated.
+ * 
+ * @param count Number of frames wanted
+ * @param frames Receives the physical addresses
+ * @return 0 on success, -1 if there isn't enough free memory
+ */
+int pmm_alloc_batch(uint32_t count, void **frames);
+
+/**
+ * @brief Allocate several zero-filled frames at once
+ * 
+ * pmm_alloc_batch() that takes from the HIGH zeroed pool first and
+ * zeroes whatever the pool could not cover.
+ * 
+ * @param count Number of frames wanted
+ * @param frames Receives the physical addresses
+ * @return 0 on success, -1 if there isn't enough free memory
+ */
+int pmm_alloc_zeroed_batch(uint32_t count, void **frames);
+
+/**
+ * @brief Free several frames at once
+ * 
+ * Same as calling pmm_free_frame() on each entry.
+ * 
+ * @param count Number of entries in frames
+ * @param frames Physical addresses to free
+ */
+void pmm_free_batch(uint32_t count, void **frames);
+
+/**
+ * @brief Top up the zeroed frame pools a little
+ * 
+ * Zeroes a small batch of free frames into the pools. Meant to be called
+ * from idle loops right before they would hlt:
+ * 
+ *     if (!pmm_zero_pool_refill()) {
+ *         __asm__ volatile("hlt");
+ *     }
+ * 
+ * Pools are left alone while their zone is low on memory.
+ * 
+ * @return true if any work was done, false if every pool is full
+ */
+bool pmm_zero_pool_refill(void);
+
 /**
  * @brief Free a physical frame
  * 
- * Returns a previously allocated frame to the pool of available frames.
- * The frame is marked as free in the bitmap and can be allocated again.
+ * Drops the allocation's reference, same as
+ * page_put(pmm_phys_to_page(phys_addr)). The frame goes back to the
+ * pool once no other holder (see page_get()) is left. Freed HIGH frames
+ * are parked in a small cache first and handed out again before any
+ * others.
  * 
  * @param phys_addr Physical address of the frame to free (must be frame-aligned)
  * @warning Must pass a PHYSICAL address, not virtual
  */
 void pmm_free_frame(void *phys_addr);
 
+/**
+ * @brief Allocate a physically contiguous block of frames
+ * 
+ * Takes a block of 2^order frames from the buddy allocator, splitting a
+ * larger free block if no block of the exact order is free. The block is
+ * naturally aligned (its address is a multiple of its size), which makes
+ * it usable for DMA buffers and large-page mappings.
+ * 
+ * @param order Block order (0 = 4KB, 1 = 8KB, ... PMM_MAX_ORDER = 4MB)
+ * @return Physical address of the first frame, or NULL if no block is free
+ * @warning Returned address is PHYSICAL, not virtual
+ */
+void* pmm_alloc_frames(uint32_t order);
+
+/**
+ * @brief Allocate a physically contiguous block of frames from a zone
+ * 
+ * Zone-aware version of pmm_alloc_frames(), with the same fallback
+ * rules as pmm_alloc_frame_zone().
+ * 
+ * @param order Block order (0 = 4KB ... PMM_MAX_ORDER = 4MB)
+ * @param zone Highest zone the block may come from
+ * @return Physical address of the first frame, or NULL if no block is free
+ */
+void* pmm_alloc_frames_zone(uint32_t order, pmm_zone_t zone);
+
+/**
+ * @brief Register a reclaim hook
+ * 
+ * Every frame allocator (single frames, blocks and batches) calls the
+ * hooks in registration order before reporting out of memory, and
+ * retries as long as one of them released something.
+ * 
+ * @param fn Hook to add
+ * @return 0 on success, -1 if the hook table is full
+ */
+int pmm_register_reclaim(pmm_reclaim_t fn);
+
+/**
+ * @brief Free a block allocated with pmm_alloc_frames()
+ * 
+ * Drops the block's reference. Once the last reference goes, all
+ * 2^order frames are returned and the block coalesces with its free
+ * buddies. The order must match the one used to allocate it.
+ * 
+ * @param phys_addr Physical address of the block (aligned to its size)
+ * @param order Order the block was allocated with
+ */
+void pmm_free_frames(void *phys_addr, uint32_t order);
+
 /**
  * @brief Mark a specific frame as used
  * 
@@ -72,6 +283,66 @@ void pmm_mark_used(uint32_t frame_number);
  */
 void pmm_mark_free(uint32_t frame_number);
 
+/**
+ * @brief Mark a range of frames as used
+ * 
+ * Range version of pmm_mark_used() for frames [start, end). Whole bitmap
+ * words are filled at once and only the edges are patched bit by bit,
+ * so reserving megabytes costs a handful of stores rather than one call
+ * per frame.
+ * 
+ * @param start First frame number
+ * @param end One past the last frame number
+ */
+void pmm_mark_range_used(uint32_t start, uint32_t end);
+
+/**
+ * @brief Mark a range of frames as free
+ * 
+ * Range version of pmm_mark_free() for frames [start, end). The range is
+ * indexed in the buddy allocator as the largest aligned blocks that fit.
+ * 
+ * @param start First frame number
+ * @param end One past the last frame number
+ */
+void pmm_mark_range_free(uint32_t start, uint32_t end);
+
+/**
+ * @brief Look up the descriptor of a physical frame
+ * 
+ * @param phys_addr Physical address anywhere inside the frame
+ * @return Descriptor, or NULL if the frame is beyond tracked memory
+ */
+page_t *pmm_phys_to_page(void *phys_addr);
+
+/**
+ * @brief Physical address of the frame a descriptor belongs to
+ * 
+ * @param page Descriptor returned by pmm_phys_to_page()
+ * @return Physical address of the frame
+ */
+void *pmm_page_to_phys(page_t *page);
+
+/**
+ * @brief Take another reference to an allocated frame
+ * 
+ * Used when a second mapping (or any other holder) starts sharing a
+ * frame. Every page_get() must be balanced by a page_put().
+ * 
+ * @param page Descriptor of an allocated frame or block head
+ */
+void page_get(page_t *page);
+
+/**
+ * @brief Drop a reference to a frame
+ * 
+ * Frees the frame (or the whole block, for a block head) when the last
+ * reference goes. Reserved frames are ignored.
+ * 
+ * @param page Descriptor of an allocated frame or block head
+ */
+void page_put(page_t *page);
+
 /**
  * @brief Get total number of frames in the system
  * 
@@ -89,6 +360,8 @@ uint32_t pmm_get_free_frames(void);
 /**
  * @brief Get number of frames currently in use
  * 
+ * Kept as a running count, so this (and pmm_dump_stats()) is O(1).
+ * 
  * @return Count of allocated frames (total - free)
  */
 uint32_t pmm_get_used_frames(void);
@@ -96,8 +369,8 @@ uint32_t pmm_get_used_frames(void);
 /**
  * @brief Print memory statistics to kernel log
  * 
- * Displays information about total, free, and used frames,
- * as well as the percentage of memory utilization.
+ * Displays information about total, free, and used frames, free
+ * frames per zone, and the number of free buddy blocks of every order.
  */
 void pmm_dump_stats(void);
 
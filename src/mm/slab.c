@@ -0,0 +1,346 @@
+#include "slab.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "kernel/log.h"
+#include "../libk/string.h"
+
+// A slab is a naturally aligned buddy block from the DIRECT zone, so it is
+// reachable through the direct map and the slab owning an object is
+// found by masking the object's address. Layout:
+//
+//   [kmem_slab_t][free index stack][colour][obj 0][obj 1]...[obj n-1][waste]
+//
+// The free stack holds indices of free objects. Objects themselves are
+// never written by the allocator, which keeps constructed state intact.
+// The head page_t of every slab points back at its cache.
+#define KMEM_MAX_ORDER   3      // Largest slab: 8 frames (32KB)
+#define KMEM_MIN_OBJECTS 8      // Grow the slab until this many fit...
+#define KMEM_MAX_WASTE   8      // ...or at most 1/8 of it is wasted
+#define KMEM_CACHE_LINE  64
+
+typedef struct kmem_slab {
+    struct kmem_slab *next;
+    struct kmem_slab *prev;
+    uint8_t *objects;       // First object, past header and colour
+    uint16_t inuse;         // Allocated objects
+    uint16_t free[];        // Free object indices, top at per_slab - inuse - 1
+} kmem_slab_t;
+
+struct kmem_cache {
+    const char *name;
+    uint32_t obj_size;      // Rounded up to the alignment
+    uint32_t align;
+    uint32_t order;         // Slab size is 2^order frames
+    uint32_t per_slab;      // Objects per slab
+    uint32_t flags;
+    kmem_ctor_t ctor;
+
+    uint32_t colours;       // Distinct colour offsets available
+    uint32_t colour_next;
+
+    kmem_slab_t *partial;   // Some objects free
+    kmem_slab_t *full;      // No objects free
+    kmem_slab_t *empty;     // All objects free (at most one kept)
+
+    // Statistics
+    uint32_t slabs;
+    uint32_t active;
+    uint32_t allocs;
+    uint32_t frees;
+
+    struct kmem_cache *next;
+};
+
+// Cache descriptors come from a cache too
+static kmem_cache_t cache_cache;
+static kmem_cache_t *caches = NULL;
+
+// ----------------- Slab lists -----------------
+
+static void slab_list_add(kmem_slab_t **head, kmem_slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void slab_list_del(kmem_slab_t **head, kmem_slab_t *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+// ----------------- Slab layout -----------------
+
+static inline uint32_t align_up(uint32_t x, uint32_t align) {
+    return (x + align - 1) & ~(align - 1);
+}
+
+// Offset of the first object in an uncoloured slab holding n objects
+static inline uint32_t slab_objects_offset(uint32_t n, uint32_t align) {
+    return align_up(sizeof(kmem_slab_t) + n * sizeof(uint16_t), align);
+}
+
+// Objects that fit in a slab of bytes, and the bytes left over
+static uint32_t slab_capacity(kmem_cache_t *cache, uint32_t bytes, uint32_t *waste) {
+    uint32_t n = (bytes - sizeof(kmem_slab_t)) / (cache->obj_size + sizeof(uint16_t));
+
+    while (n > 0 && slab_objects_offset(n, cache->align) + n * cache->obj_size > bytes) {
+        n--;
+    }
+
+    *waste = (n > 0) ? bytes - slab_objects_offset(n, cache->align) - n * cache->obj_size : bytes;
+    return n;
+}
+
+static int cache_setup(kmem_cache_t *cache, const char *name, size_t size,
+                       size_t align, uint32_t flags, kmem_ctor_t ctor) {
+    if (align == 0) {
+        align = 8;
+    }
+
+    if (size == 0 || (align & (align - 1)) || align > FRAME_SIZE) {
+        klogf("[slab] ERROR: Bad cache '%s' (size %u, align %u)\n",
+              name, (uint32_t)size, (uint32_t)align);
+        return -1;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    cache->name = name;
+    cache->align = align;
+    cache->obj_size = align_up(size, align);
+    cache->flags = flags;
+    cache->ctor = ctor;
+
+    // Smallest slab that holds enough objects without wasting much
+    uint32_t waste = 0;
+    for (cache->order = 0; cache->order <= KMEM_MAX_ORDER; cache->order++) {
+        uint32_t bytes = FRAME_SIZE << cache->order;
+        cache->per_slab = slab_capacity(cache, bytes, &waste);
+
+        if (cache->per_slab >= KMEM_MIN_OBJECTS ||
+            (cache->per_slab > 0 && waste * KMEM_MAX_WASTE <= bytes)) {
+            break;
+        }
+    }
+
+    if (cache->order > KMEM_MAX_ORDER) {
+        cache->order = KMEM_MAX_ORDER;
+    }
+
+    if (cache->per_slab == 0) {
+        klogf("[slab] ERROR: Object size %u too large for cache '%s'\n",
+              (uint32_t)size, name);
+        return -1;
+    }
+
+    // Leftover bytes at the end of the slab double as colour offsets
+    uint32_t colour_unit = (align > KMEM_CACHE_LINE) ? align : KMEM_CACHE_LINE;
+    cache->colours = (flags & KMEM_CACHE_COLOUR) ? waste / colour_unit + 1 : 1;
+
+    return 0;
+}
+
+// ----------------- Slabs -----------------
+
+static kmem_slab_t *slab_create(kmem_cache_t *cache) {
+    void *phys = pmm_alloc_frames_zone(cache->order, PMM_ZONE_DIRECT);
+    if (!phys) {
+        klogf("[slab] ERROR: Out of memory growing cache '%s'\n", cache->name);
+        return NULL;
+    }
+
+    page_t *page = pmm_phys_to_page(phys);
+    page->owner = cache;
+    page->flags |= PG_SLAB;
+
+    uint32_t colour_unit = (cache->align > KMEM_CACHE_LINE) ? cache->align : KMEM_CACHE_LINE;
+    uint32_t colour = cache->colour_next * colour_unit;
+    if (++cache->colour_next >= cache->colours) {
+        cache->colour_next = 0;
+    }
+
+    // The direct map keeps the block's alignment
+    kmem_slab_t *slab = (kmem_slab_t*)PHYS_TO_VIRT(phys);
+    slab->objects = (uint8_t*)slab + slab_objects_offset(cache->per_slab, cache->align) + colour;
+    slab->inuse = 0;
+
+    // Lowest index on top so objects are handed out in address order
+    for (uint32_t i = 0; i < cache->per_slab; i++) {
+        slab->free[i] = (uint16_t)(cache->per_slab - 1 - i);
+    }
+
+    if (cache->ctor) {
+        for (uint32_t i = 0; i < cache->per_slab; i++) {
+            cache->ctor(slab->objects + i * cache->obj_size);
+        }
+    }
+
+    cache->slabs++;
+    return slab;
+}
+
+static void slab_destroy(kmem_cache_t *cache, kmem_slab_t *slab) {
+    page_t *page = pmm_phys_to_page((void*)VIRT_TO_PHYS(slab));
+    page->owner = NULL;
+    page->flags &= ~PG_SLAB;
+
+    cache->slabs--;
+    pmm_free_frames((void*)VIRT_TO_PHYS(slab), cache->order);
+}
+
+// ----------------- Public API -----------------
+
+void kmem_init(void) {
+    klogf("[slab] Initializing slab allocator...\n");
+
+    caches = NULL;
+    cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), 0, 0, NULL);
+    cache_cache.next = caches;
+    caches = &cache_cache;
+
+    klogf("[slab] Slab allocator initialized\n");
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                uint32_t flags, kmem_ctor_t ctor) {
+    kmem_cache_t *cache = kmem_cache_alloc(&cache_cache);
+    if (!cache) {
+        return NULL;
+    }
+
+    if (cache_setup(cache, name, size, align, flags, ctor) < 0) {
+        kmem_cache_free(&cache_cache, cache);
+        return NULL;
+    }
+
+    cache->next = caches;
+    caches = cache;
+
+    klogf("[slab] Created cache '%s': %u byte objects, %u per %u KB slab, %u colours\n",
+          name, cache->obj_size, cache->per_slab,
+          (FRAME_SIZE << cache->order) / 1024, cache->colours);
+    return cache;
+}
+
+void kmem_cache_destroy(kmem_cache_t *cache) {
+    if (!cache) {
+        return;
+    }
+
+    if (cache->active) {
+        klogf("[slab] ERROR: Destroying cache '%s' with %u live objects\n",
+              cache->name, cache->active);
+        return;
+    }
+
+    while (cache->empty) {
+        kmem_slab_t *slab = cache->empty;
+        slab_list_del(&cache->empty, slab);
+        slab_destroy(cache, slab);
+    }
+
+    for (kmem_cache_t **link = &caches; *link; link = &(*link)->next) {
+        if (*link == cache) {
+            *link = cache->next;
+            break;
+        }
+    }
+
+    kmem_cache_free(&cache_cache, cache);
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    kmem_slab_t *slab = cache->partial;
+
+    if (!slab) {
+        slab = cache->empty;
+        if (slab) {
+            slab_list_del(&cache->empty, slab);
+        } else {
+            slab = slab_create(cache);
+            if (!slab) {
+                return NULL;
+            }
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+
+    uint32_t idx = slab->free[cache->per_slab - slab->inuse - 1];
+    slab->inuse++;
+
+    if (slab->inuse == cache->per_slab) {
+        slab_list_del(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+
+    cache->active++;
+    cache->allocs++;
+    return slab->objects + idx * cache->obj_size;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (!obj) {
+        return;
+    }
+
+    uint32_t slab_bytes = FRAME_SIZE << cache->order;
+    kmem_slab_t *slab = (kmem_slab_t*)((uint32_t)obj & ~(slab_bytes - 1));
+    page_t *page = pmm_phys_to_page((void*)VIRT_TO_PHYS(slab));
+
+    if (!page || page->owner != cache) {
+        klogf("[slab] ERROR: 0x%08x does not belong to cache '%s'\n",
+              (uint32_t)obj, cache->name);
+        return;
+    }
+
+    uint32_t offset = (uint8_t*)obj - slab->objects;
+    uint32_t idx = offset / cache->obj_size;
+    if ((uint8_t*)obj < slab->objects || offset % cache->obj_size || idx >= cache->per_slab) {
+        klogf("[slab] ERROR: Bad object pointer 0x%08x for cache '%s'\n",
+              (uint32_t)obj, cache->name);
+        return;
+    }
+
+    bool was_full = (slab->inuse == cache->per_slab);
+
+    slab->inuse--;
+    slab->free[cache->per_slab - slab->inuse - 1] = (uint16_t)idx;
+    cache->active--;
+    cache->frees++;
+
+    if (was_full) {
+        slab_list_del(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    if (slab->inuse == 0) {
+        slab_list_del(&cache->partial, slab);
+
+        // Keep one empty slab around so a cache hovering at a slab
+        // boundary doesn't go back to the PMM on every alloc/free
+        if (cache->empty) {
+            slab_destroy(cache, slab);
+        } else {
+            slab_list_add(&cache->empty, slab);
+        }
+    }
+}
+
+void kmem_dump_stats(void) {
+    klogf("[slab] ===== Slab Caches =====\n");
+    for (kmem_cache_t *cache = caches; cache; cache = cache->next) {
+        klogf("[slab] %s: %u of %u objects active, %u slabs (%u KB), %u allocs, %u frees\n",
+              cache->name, cache->active, cache->slabs * cache->per_slab,
+              cache->slabs, cache->slabs * ((FRAME_SIZE << cache->order) / 1024),
+              cache->allocs, cache->frees);
+    }
+    klogf("[slab] ========================\n");
+}
@@ -0,0 +1,93 @@
+/**
+ * @file slab.h
+ * @brief Slab Object Caches
+ *
+ * Fixed-size object allocator for the kernel's hot structures (inodes,
+ * block buffers, file and process structs). Each cache hands out objects
+ * of one size from slabs, i.e. naturally aligned blocks of frames taken
+ * straight from the PMM's direct mapped zone. Compared to kalloc():
+ * - no per-object header, objects are packed back to back
+ * - allocation and free are a pop/push on the slab's free index stack
+ * - an optional constructor runs once per object, when its slab is
+ *   created, not on every allocation
+ * - slabs can start their objects at staggered offsets (colouring) so
+ *   objects from different slabs don't all compete for the same cache sets
+ *
+ * Objects must be returned to the cache they came from.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** @brief Stagger object offsets between slabs by a cache line */
+#define KMEM_CACHE_COLOUR  (1 << 0)
+
+/** @brief Opaque object cache */
+typedef struct kmem_cache kmem_cache_t;
+
+/**
+ * @brief Object constructor
+ *
+ * Called once for every object when its slab is created. Users must hand
+ * objects back to kmem_cache_free() in the constructed state.
+ */
+typedef void (*kmem_ctor_t)(void *obj);
+
+/**
+ * @brief Initialize the slab allocator
+ *
+ * Sets up the cache that cache descriptors themselves come from.
+ * Must be called after pmm_init() and before kmem_cache_create().
+ */
+void kmem_init(void);
+
+/**
+ * @brief Create an object cache
+ *
+ * @param name Name shown in statistics (must stay valid)
+ * @param size Object size in bytes
+ * @param align Object alignment (0 = 8 bytes), must be a power of two
+ * @param flags KMEM_CACHE_* flags
+ * @param ctor Constructor, or NULL
+ * @return New cache, or NULL if the size is unsupported or memory ran out
+ */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                uint32_t flags, kmem_ctor_t ctor);
+
+/**
+ * @brief Destroy an object cache
+ *
+ * Returns every slab to the PMM. Refuses (and logs) if objects are still
+ * allocated from the cache.
+ *
+ * @param cache Cache to destroy
+ */
+void kmem_cache_destroy(kmem_cache_t *cache);
+
+/**
+ * @brief Allocate an object
+ *
+ * @param cache Cache to allocate from
+ * @return Object, or NULL if out of memory
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/**
+ * @brief Return an object to its cache
+ *
+ * Empty slabs beyond one spare per cache go back to the PMM right away.
+ *
+ * @param cache Cache the object was allocated from
+ * @param obj Object to free (NULL is ignored)
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/**
+ * @brief Print usage statistics of every cache to the kernel log
+ */
+void kmem_dump_stats(void);
+
+#endif // SLAB_H
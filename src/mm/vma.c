@@ -0,0 +1,287 @@
+#include "vma.h"
+#include "heap.h"
+#include "../libk/string.h"
+#include "../drivers/vfs/vfs.h"
+
+#define VMA_MIN_CAPACITY 8
+
+// Index of the first area ending above addr (count if there is none)
+static uint32_t vma_search(vma_table_t *table, uint32_t addr) {
+    uint32_t lo = 0;
+    uint32_t hi = table->count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (table->areas[mid].end <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+// Make room for count areas, doubling the array as needed
+static int vma_reserve(vma_table_t *table, uint32_t count) {
+    if (count <= table->capacity) {
+        return 0;
+    }
+
+    uint32_t capacity = table->capacity ? table->capacity : VMA_MIN_CAPACITY;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+
+    vma_t *areas = kalloc(capacity * sizeof(vma_t));
+    if (!areas) {
+        return -1;
+    }
+
+    if (table->count) {
+        memcpy(areas, table->areas, table->count * sizeof(vma_t));
+    }
+    kfree(table->areas);
+
+    table->areas = areas;
+    table->capacity = capacity;
+    return 0;
+}
+
+// File areas are never merged, each keeps its own file position
+static inline bool vma_mergeable(const vma_t *vma, const vma_t *area) {
+    return vma->flags == area->flags && vma->backing == area->backing &&
+           area->backing != VMA_FILE;
+}
+
+// Move an area's start, keeping a file area's pages at the same file data
+static inline void vma_set_start(vma_t *vma, uint32_t start) {
+    if (vma->backing == VMA_FILE) {
+        vma->offset += start - vma->start;
+    }
+    vma->start = start;
+}
+
+vma_file_t *vma_file_open(file_t *vfile) {
+    vma_file_t *file = kalloc(sizeof(vma_file_t));
+    if (!file) {
+        return NULL;
+    }
+
+    file->file = vfile;
+    file->refs = 1;
+    file->image = NULL;
+    return file;
+}
+
+void vma_file_get(vma_file_t *file) {
+    if (file) {
+        file->refs++;
+    }
+}
+
+void vma_file_put(vma_file_t *file) {
+    if (file && --file->refs == 0) {
+        image_put(file->image);
+        vfs_file_close(file->file);
+        kfree(file);
+    }
+}
+
+vma_t *vma_find(vma_table_t *table, uint32_t addr) {
+    if (table->hint < table->count) {
+        vma_t *vma = &table->areas[table->hint];
+        if (vma->start <= addr && addr < vma->end) {
+            return vma;
+        }
+    }
+
+    uint32_t i = vma_search(table, addr);
+    if (i == table->count || table->areas[i].start > addr) {
+        return NULL;
+    }
+
+    table->hint = i;
+    return &table->areas[i];
+}
+
+int vma_insert(vma_table_t *table, const vma_t *area) {
+    uint32_t start = area->start;
+    uint32_t end = area->end;
+
+    if (start >= end) {
+        return -1;
+    }
+
+    uint32_t i = vma_search(table, start);
+    if (i < table->count && table->areas[i].start < end) {
+        return -1;
+    }
+
+    // Growing a neighbour (brk does this all the time) keeps the array short
+    vma_t *prev = (i > 0) ? &table->areas[i - 1] : NULL;
+    vma_t *next = (i < table->count) ? &table->areas[i] : NULL;
+    bool join_prev = prev && prev->end == start && vma_mergeable(prev, area);
+    bool join_next = next && next->start == end && vma_mergeable(next, area);
+
+    if (join_prev && join_next) {
+        prev->end = next->end;
+        memmove(next, next + 1, (table->count - i - 1) * sizeof(vma_t));
+        table->count--;
+        table->hint = i - 1;
+        return 0;
+    }
+
+    if (join_prev) {
+        prev->end = end;
+        table->hint = i - 1;
+        return 0;
+    }
+
+    if (join_next) {
+        next->start = start;
+        table->hint = i;
+        return 0;
+    }
+
+    if (vma_reserve(table, table->count + 1) < 0) {
+        return -1;
+    }
+
+    memmove(&table->areas[i + 1], &table->areas[i], (table->count - i) * sizeof(vma_t));
+    table->areas[i] = *area;
+    vma_file_get(area->file);
+    table->count++;
+    table->hint = i;
+    return 0;
+}
+
+int vma_remove(vma_table_t *table, uint32_t start, uint32_t end) {
+    uint32_t i = vma_search(table, start);
+    if (start >= end || i == table->count || table->areas[i].start >= end) {
+        return 0;
+    }
+
+    // Hole in the middle of one area, it splits in two
+    if (table->areas[i].start < start && table->areas[i].end > end) {
+        if (vma_reserve(table, table->count + 1) < 0) {
+            return -1;
+        }
+
+        memmove(&table->areas[i + 1], &table->areas[i], (table->count - i) * sizeof(vma_t));
+        vma_file_get(table->areas[i].file);
+        table->areas[i].end = start;
+        vma_set_start(&table->areas[i + 1], end);
+        table->count++;
+        return 0;
+    }
+
+    // Trim the area reaching in from below
+    if (table->areas[i].start < start) {
+        table->areas[i].end = start;
+        i++;
+    }
+
+    // Drop the areas inside, trim the one reaching out above
+    uint32_t first = i;
+    while (i < table->count && table->areas[i].end <= end) {
+        vma_file_put(table->areas[i].file);
+        i++;
+    }
+
+    if (i < table->count && table->areas[i].start < end) {
+        vma_set_start(&table->areas[i], end);
+    }
+
+    memmove(&table->areas[first], &table->areas[i], (table->count - i) * sizeof(vma_t));
+    table->count -= i - first;
+    return 0;
+}
+
+int vma_protect(vma_table_t *table, uint32_t start, uint32_t end, uint32_t flags) {
+    if (!vma_covers(table, start, end, 0)) {
+        return -1;
+    }
+
+    uint32_t addr = start;
+    while (addr < end) {
+        vma_t piece = *vma_find(table, addr);
+        uint32_t piece_end = (piece.end < end) ? piece.end : end;
+
+        if (piece.flags != flags) {
+            // Room for a split and an insert, so neither can fail halfway
+            if (vma_reserve(table, table->count + 2) < 0) {
+                return -1;
+            }
+
+            vma_set_start(&piece, addr);
+            piece.end = piece_end;
+            piece.flags = flags;
+
+            // The piece holds the file while it's out of the table
+            vma_file_get(piece.file);
+            vma_remove(table, addr, piece_end);
+            vma_insert(table, &piece);
+            vma_file_put(piece.file);
+        }
+
+        addr = piece_end;
+    }
+
+    return 0;
+}
+
+bool vma_covers(vma_table_t *table, uint32_t start, uint32_t end, uint32_t flags) {
+    if (start >= end) {
+        return true;
+    }
+
+    vma_t *vma = vma_find(table, start);
+    if (!vma) {
+        return false;
+    }
+
+    vma_t *last = table->areas + table->count;
+    for (;;) {
+        if ((vma->flags & flags) != flags) {
+            return false;
+        }
+
+        if (vma->end >= end) {
+            return true;
+        }
+
+        // The next area has to pick up exactly where this one ends
+        vma_t *next = vma + 1;
+        if (next == last || next->start != vma->end) {
+            return false;
+        }
+        vma = next;
+    }
+}
+
+int vma_table_copy(vma_table_t *dst, const vma_table_t *src) {
+    if (vma_reserve(dst, src->count) < 0) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < src->count; i++) {
+        dst->areas[i] = src->areas[i];
+        vma_file_get(src->areas[i].file);
+    }
+    dst->count = src->count;
+    dst->hint = 0;
+    return 0;
+}
+
+void vma_table_release(vma_table_t *table) {
+    for (uint32_t i = 0; i < table->count; i++) {
+        vma_file_put(table->areas[i].file);
+    }
+    kfree(table->areas);
+
+    table->areas = NULL;
+    table->count = 0;
+    table->capacity = 0;
+    table->hint = 0;
+}
@@ -0,0 +1,163 @@
+/**
+ * @file vma.h
+ * @brief Virtual Memory Areas
+ *
+ * Record of which user ranges of an address space are valid, with their
+ * protections and what backs their pages. The VMM consults it to resolve
+ * page faults, and syscalls go through it (vmm_check_user()) before they
+ * touch a user pointer.
+ *
+ * Areas live in an array sorted by address, so finding the area holding
+ * an address is a binary search. The last area found is remembered as
+ * well: faults and syscalls tend to hit the same area several times in a
+ * row (a stack growing, a buffer being filled), and those lookups cost a
+ * single compare.
+ */
+
+#ifndef VMA_H
+#define VMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "image.h"
+
+/** @brief What provides an area's pages */
+typedef enum {
+    VMA_ANON = 0,   /**< Demand-zero, a missing page gets a zeroed frame */
+    VMA_LOADED,     /**< Mapped when the area was set up (ELF file data), never faulted in */
+    VMA_FILE,       /**< Read from a file into a private frame on first touch */
+} vma_backing_t;
+
+/**
+ * @brief Open file shared by the areas mapping it
+ *
+ * Holds a VFS file open for as long as any area (in any address space)
+ * refers to it. The file has no descriptor, so user space can't close it
+ * or move it under the areas. Executables also carry their image, through which
+ * read-only pages are shared with other processes running the same file.
+ */
+typedef struct {
+    struct file *file;          /**< Opened with vfs_file_open() */
+    uint32_t refs;
+    image_t *image;             /**< Shared page cache, NULL = none */
+} vma_file_t;
+
+/** @brief One area, [start, end) */
+typedef struct {
+    uint32_t start;             /**< Page aligned */
+    uint32_t end;               /**< Page aligned, exclusive */
+    uint32_t flags;             /**< PTE flags of its pages (PAGE_USER, PAGE_RW) */
+    vma_backing_t backing;
+    vma_file_t *file;           /**< VMA_FILE: file the pages come from, else NULL */
+    uint32_t offset;            /**< VMA_FILE: file position of start */
+    uint32_t file_end;          /**< VMA_FILE: address where file data stops, zero above */
+} vma_t;
+
+/**
+ * @brief Areas of one address space
+ *
+ * Zero-initialize; the array is allocated on the first insert.
+ */
+typedef struct {
+    vma_t *areas;               /**< Sorted by address, never overlapping */
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t hint;              /**< Index of the last area found */
+} vma_table_t;
+
+/**
+ * @brief Wrap an open file for file areas
+ *
+ * @param file File from vfs_file_open(), owned by the result from now on
+ * @return File with one reference, or NULL if out of memory (file is left open)
+ */
+vma_file_t *vma_file_open(struct file *file);
+
+/** @brief Take a reference to a file (NULL is ignored) */
+void vma_file_get(vma_file_t *file);
+
+/** @brief Drop a reference, closing the file (and releasing the image) with the last one (NULL is ignored) */
+void vma_file_put(vma_file_t *file);
+
+/**
+ * @brief Find the area holding an address
+ *
+ * @param table Areas to search
+ * @param addr Address
+ * @return The area, or NULL if addr is in none. Valid until the table changes.
+ */
+vma_t *vma_find(vma_table_t *table, uint32_t addr);
+
+/**
+ * @brief Add an area
+ *
+ * An area touching a neighbour with the same flags and backing is merged
+ * into it instead of taking a new slot (file areas excepted). A file
+ * area takes its own reference to the file.
+ *
+ * @param table Areas
+ * @param area Area to add (start and end page aligned)
+ * @return 0 on success, -1 if the range overlaps an area or out of memory
+ */
+int vma_insert(vma_table_t *table, const vma_t *area);
+
+/**
+ * @brief Remove a range from the areas
+ *
+ * Areas inside the range are dropped, areas crossing its edges are
+ * trimmed, and an area containing the whole range is split in two. File
+ * areas keep their pages lined up with the same file data.
+ *
+ * @param table Areas
+ * @param start First address (page aligned)
+ * @param end End address (page aligned, exclusive)
+ * @return 0 on success, -1 if out of memory splitting an area
+ */
+int vma_remove(vma_table_t *table, uint32_t start, uint32_t end);
+
+/**
+ * @brief Change the flags of a range of areas
+ *
+ * Areas crossing the range's edges are split so only the range changes;
+ * backings and file positions stay as they were, and the pieces merge
+ * with neighbours that now match. Page tables are not touched.
+ *
+ * @param table Areas
+ * @param start First address (page aligned)
+ * @param end End address (page aligned, exclusive)
+ * @param flags New flags
+ * @return 0 on success, -1 if part of the range is in no area or out of
+ *         memory
+ */
+int vma_protect(vma_table_t *table, uint32_t start, uint32_t end, uint32_t flags);
+
+/**
+ * @brief Check that a range is covered by areas without gaps
+ *
+ * @param table Areas
+ * @param start First address
+ * @param end End address (exclusive)
+ * @param flags Flags every covering area must have
+ * @return true if every byte of [start, end) is in an area with flags
+ */
+bool vma_covers(vma_table_t *table, uint32_t start, uint32_t end, uint32_t flags);
+
+/**
+ * @brief Copy every area of a table into an empty one
+ *
+ * @param dst Empty table
+ * @param src Areas to copy
+ * @return 0 on success, -1 if out of memory
+ */
+int vma_table_copy(vma_table_t *dst, const vma_table_t *src);
+
+/**
+ * @brief Free a table's array
+ *
+ * The table is left empty and can be used again.
+ *
+ * @param table Areas
+ */
+void vma_table_release(vma_table_t *table);
+
+#endif // VMA_H
@@ -0,0 +1,116 @@
+#include "vmalloc.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "slab.h"
+#include "kernel/log.h"
+
+// Areas are kept in a list sorted by address and placed first fit. Each
+// one reserves a guard page past its end, so an overrun faults instead of
+// running into the next buffer. Page tables for the window are created by
+// the VMM the first time a page in their 4MB range is mapped.
+#define VMALLOC_BATCH 32    // Frames taken from the PMM at once
+
+typedef struct vm_area {
+    uint32_t start;
+    uint32_t pages;             // Mapped pages, guard not included
+    struct vm_area *next;
+} vm_area_t;
+
+static kmem_cache_t *area_cache = NULL;
+static vm_area_t *areas = NULL;
+static uint32_t used_pages = 0;
+
+void vmalloc_init(void) {
+    area_cache = kmem_cache_create("vm_area", sizeof(vm_area_t), 0, 0, NULL);
+    if (!area_cache) {
+        klogf("[vmalloc] ERROR: Failed to create area cache\n");
+        return;
+    }
+
+    klogf("[vmalloc] Window 0x%08x - 0x%08x (%u MB)\n",
+          VMALLOC_START, VMALLOC_END, (VMALLOC_END - VMALLOC_START) / (1024 * 1024));
+}
+
+void *vmalloc(size_t size) {
+    if (size == 0 || !area_cache) {
+        return NULL;
+    }
+
+    uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t span = (pages + 1) * PAGE_SIZE;  // Plus the guard page
+
+    if (span > VMALLOC_END - VMALLOC_START) {
+        klogf("[vmalloc] ERROR: %u bytes is larger than the window\n", (uint32_t)size);
+        return NULL;
+    }
+
+    // First gap that fits
+    uint32_t start = VMALLOC_START;
+    vm_area_t **link = &areas;
+    while (*link && (*link)->start - start < span) {
+        start = (*link)->start + ((*link)->pages + 1) * PAGE_SIZE;
+        link = &(*link)->next;
+    }
+
+    if (VMALLOC_END - start < span) {
+        klogf("[vmalloc] ERROR: Out of address space for %u pages\n", pages);
+        return NULL;
+    }
+
+    vm_area_t *area = kmem_cache_alloc(area_cache);
+    if (!area) {
+        return NULL;
+    }
+
+    void *frames[VMALLOC_BATCH];
+    uint32_t mapped = 0;
+    while (mapped < pages) {
+        uint32_t count = pages - mapped;
+        if (count > VMALLOC_BATCH) count = VMALLOC_BATCH;
+
+        if (pmm_alloc_batch(count, frames) < 0) {
+            klogf("[vmalloc] ERROR: Out of memory for %u pages\n", pages);
+            vmm_free_range(start, mapped);
+            kmem_cache_free(area_cache, area);
+            return NULL;
+        }
+
+        vmm_map_range(start + mapped * PAGE_SIZE, frames, count, PAGE_PRESENT | PAGE_RW);
+        mapped += count;
+    }
+
+    area->start = start;
+    area->pages = pages;
+    area->next = *link;
+    *link = area;
+
+    used_pages += pages;
+    return (void*)start;
+}
+
+void vfree(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    vm_area_t **link = &areas;
+    while (*link && (*link)->start != (uint32_t)ptr) {
+        link = &(*link)->next;
+    }
+
+    vm_area_t *area = *link;
+    if (!area) {
+        klogf("[vmalloc] ERROR: vfree of unknown address 0x%08x\n", (uint32_t)ptr);
+        return;
+    }
+
+    *link = area->next;
+    vmm_free_range(area->start, area->pages);
+
+    used_pages -= area->pages;
+    kmem_cache_free(area_cache, area);
+}
+
+uint32_t vmalloc_get_used_pages(void) {
+    return used_pages;
+}
@@ -0,0 +1,61 @@
+/**
+ * @file vmalloc.h
+ * @brief Virtually Contiguous Kernel Allocations
+ *
+ * vmalloc() hands out page-granular buffers in a reserved kernel virtual
+ * window. The buffer is contiguous in virtual memory only: it is backed
+ * by whatever frames the PMM has free, so large allocations neither need
+ * a physically contiguous block nor fragment the kernel heap. Every area
+ * is followed by an unmapped guard page, and vfree() returns the frames
+ * to the PMM right away.
+ *
+ * Meant for large, short-lived buffers (whole files, big tables). Small
+ * objects belong in kalloc() or a slab cache.
+ */
+
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** @brief Start of the vmalloc window */
+#define VMALLOC_START 0xE0000000
+
+/** @brief End of the vmalloc window (exclusive) */
+#define VMALLOC_END   0xF0000000
+
+/**
+ * @brief Initialize the vmalloc window
+ *
+ * Must be called after kmem_init().
+ */
+void vmalloc_init(void);
+
+/**
+ * @brief Allocate a virtually contiguous buffer
+ *
+ * The buffer is page aligned and its contents are undefined.
+ *
+ * @param size Bytes to allocate (rounded up to whole pages)
+ * @return Virtual address, or NULL if out of address space or memory
+ */
+void *vmalloc(size_t size);
+
+/**
+ * @brief Free a buffer from vmalloc()
+ *
+ * Unmaps the area and returns its frames to the PMM.
+ *
+ * @param ptr Address returned by vmalloc() (NULL is ignored)
+ */
+void vfree(void *ptr);
+
+/**
+ * @brief Get the number of pages currently mapped by vmalloc()
+ *
+ * @return Pages in use
+ */
+uint32_t vmalloc_get_used_pages(void);
+
+#endif // VMALLOC_H
@@ -1,9 +1,11 @@
 #include "vmm.h"
 #include "kernel/log.h"
 #include "pmm.h"
+#include "slab.h"
 #include "../libk//kprint.h"
 #include "../libk/string.h"
 #include "../kernel/panic.h"
+#include "../drivers/vfs/vfs.h"
 #include <stdint.h>
 
 typedef struct {
@@ -14,70 +16,235 @@ typedef struct {
     uint32_t entries[1024];
 } page_directory_t;
 
-// Kernel page directory (identity-mapped)
+// The last directory entry points at the directory itself, so once one of
+// our directories is loaded every page table shows up in the top 4MB of the
+// address space and the directory in its last page. Tables can live in any
+// frame.
+#define VMM_RECURSIVE_PDE   1023
+#define VMM_TABLES_VIRT     0xFFC00000
+#define VMM_DIRECTORY_VIRT  0xFFFFF000
+
+// Every address space has its own directory. The user half (USER_SPACE_START
+// to USER_SPACE_END) is private, the rest are kernel entries pointing at the
+// same page tables everywhere. The boot directory is the master copy of the
+// kernel entries; changing one bumps kernel_pde_gen, and an address space
+// that was built from an older generation copies them again when switched
+// to. Directories live in the direct map so any of them can be reached.
+#define USER_PDE_FIRST  (USER_SPACE_START >> 22)
+#define USER_PDE_END    (USER_SPACE_END >> 22)
+
+struct address_space {
+    page_directory_t *directory;    // Direct map address
+    uint32_t kernel_gen;            // Kernel entries are from this generation
+    vma_table_t vmas;               // Valid user ranges
+};
+
+static address_space_t kernel_space;
+static address_space_t *current_space = &kernel_space;
+static uint32_t kernel_pde_gen = 0;
+static kmem_cache_t *space_cache = NULL;
+
+// Master directory, the boot address space's
 static page_directory_t *kernel_directory = NULL;
 
-// Helper: Requires a region to be identity mapped
-static inline void vmm_require_idmapped(void *phys, const char *what) {
-    uint32_t p = (uint32_t)phys;
+// Set once CR3 holds one of our directories. Until then the temporary
+// directory from boot.S is live, and ours is built through the direct map.
+static bool directory_loaded = false;
+
+// CPU support for 4MB pages (CR4.PSE) and global pages (CR4.PGE)
+#define CPUID_FEAT_PSE  (1 << 3)
+#define CPUID_FEAT_PGE  (1 << 13)
+#define CR4_PSE         (1 << 4)
+#define CR0_WP          (1 << 16)
+#define CR4_PGE         (1 << 7)
+
+static bool pse_enabled = false;
+static bool pge_enabled = false;
+
+// Scratch page used to reach frames outside the direct map
+#define VMM_SCRATCH_VIRT 0xFF800000
+
+// TLB invalidations collected by a range operation. Entries that were not
+// present can't be cached, so only pages that had a mapping are recorded;
+// past TLB_GATHER_MAX of them one full flush is cheaper than the invlpgs.
+#define TLB_GATHER_MAX   32
+#define VMM_FREE_BATCH   64     // Frames handed back to the PMM at once
+
+typedef struct {
+    uint32_t addrs[TLB_GATHER_MAX];
+    uint32_t count;
+    bool full;                  // Too many pages, flush everything
+    bool global;                // A global entry changed, CR3 reload won't do
+} tlb_gather_t;
+
+// Helper: The current directory as currently reachable
+static inline page_directory_t *vmm_directory(void) {
+    if (!directory_loaded) {
+        return current_space->directory;
+    }
+    return (page_directory_t*)VMM_DIRECTORY_VIRT;
+}
+
+// Helper: Page table dir_index as currently reachable (must be present)
+static inline page_table_t *vmm_table(uint32_t dir_index) {
+    if (!directory_loaded) {
+        return (page_table_t*)PHYS_TO_VIRT(current_space->directory->entries[dir_index] & ~0xFFF);
+    }
+    return (page_table_t*)(VMM_TABLES_VIRT + dir_index * PAGE_SIZE);
+}
+
+// Helper: Zone for new page tables. Before our directory is loaded there
+// is no recursive mapping, so tables must be reachable through the direct map.
+static inline pmm_zone_t vmm_table_zone(void) {
+    return directory_loaded ? PMM_ZONE_HIGH : PMM_ZONE_DIRECT;
+}
+
+// Kernel entries are the ones above the user half (which starts in PDE 0)
+static inline bool vmm_is_kernel_pde(uint32_t dir_index) {
+    return dir_index >= USER_PDE_END && dir_index != VMM_RECURSIVE_PDE;
+}
+
+// Helper: Set a directory entry of the current address space, keeping the
+// master copy in step for kernel entries
+static void vmm_set_pde(uint32_t dir_index, uint32_t value) {
+    vmm_directory()->entries[dir_index] = value;
+
+    if (vmm_is_kernel_pde(dir_index)) {
+        kernel_directory->entries[dir_index] = value;
+        current_space->kernel_gen = ++kernel_pde_gen;
+    }
+}
+
+// Helper: Copy the master's kernel entries into a directory
+static void vmm_sync_kernel_pdes(address_space_t *space) {
+    for (uint32_t i = 0; i < 1024; i++) {
+        if (vmm_is_kernel_pde(i)) {
+            space->directory->entries[i] = kernel_directory->entries[i];
+        }
+    }
+    space->kernel_gen = kernel_pde_gen;
+}
+
+// Helper: Run fn on a frame through the scratch page
+static void vmm_with_scratch(uint32_t phys, void (*fn)(void *page, uint32_t arg), uint32_t arg) {
+    if (phys < DIRECT_MAP_LIMIT) {
+        fn(PHYS_TO_VIRT(phys), arg);
+        return;
+    }
+
+    if (!directory_loaded) {
+        panicf("[vmm] Frame 0x%08x is out of reach before vmm_init()\n", phys);
+    }
+
+    // Keep interrupts off while the scratch page is borrowed
+    uint32_t eflags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(eflags) :: "memory");
+
+    vmm_map_page(VMM_SCRATCH_VIRT, phys, PAGE_PRESENT | PAGE_RW);
+    fn((void*)VMM_SCRATCH_VIRT, arg);
+    vmm_unmap_page(VMM_SCRATCH_VIRT);
+
+    if (eflags & 0x200) {
+        __asm__ volatile("sti" ::: "memory");
+    }
+}
+
+static void fill_zero(void *page, uint32_t arg) {
+    (void)arg;
+    memset(page, 0, PAGE_SIZE);
+}
+
+// Fill a page table with the 4KB equivalent of the 4MB entry pde
+static void fill_split(void *page, uint32_t pde) {
+    page_table_t *table = (page_table_t*)page;
+    uint32_t base = pde & 0xFFC00000;
+    uint32_t flags = pde & (0xFFF & ~PAGE_LARGE);
 
-    if (p >= IDMAP_LIMIT) {
-        panicf("[vmm] %s at phys 0x%08x is outside idmap (<0x%08x)\n", what, p, IDMAP_LIMIT);
+    for (uint32_t i = 0; i < 1024; i++) {
+        table->entries[i] = (base + i * PAGE_SIZE) | flags;
     }
 }
 
-// Helper: Get page table for a virtual address, creating if needed
+// Helper: Replace a 4MB page with a page table mapping the same frames.
+// The table is filled before it goes live, so the code doing this may
+// run from inside the page being split.
+static void vmm_split_large(uint32_t dir_index) {
+    uint32_t pde = vmm_directory()->entries[dir_index];
+
+    void *table_phys = pmm_alloc_frame_zone(vmm_table_zone());
+    if (!table_phys) {
+        panicf("[vmm] ERROR: Failed to allocate page table for 4MB page split\n");
+    }
+
+    vmm_with_scratch((uint32_t)table_phys, fill_split, pde);
+
+    vmm_set_pde(dir_index, (uint32_t)table_phys | (pde & (PAGE_PRESENT | PAGE_RW | PAGE_USER)));
+
+    // One invlpg drops the whole 4MB entry (global or not) and the stale
+    // recursive slot of the table
+    if (directory_loaded) {
+        __asm__ volatile("invlpg (%0)" :: "r"(dir_index << 22) : "memory");
+        __asm__ volatile("invlpg (%0)" :: "r"(vmm_table(dir_index)) : "memory");
+    }
+}
+
+// Helper: Get page table for a virtual address, creating if needed.
+// NULL if there is none, or if creating it ran out of memory.
 static page_table_t* get_page_table(uint32_t virt, bool create, uint32_t flags) {
+    page_directory_t *dir = vmm_directory();
     uint32_t dir_index = virt >> 22;
     
+    // Changing a page inside a 4MB page needs a real table
+    if ((dir->entries[dir_index] & (PAGE_PRESENT | PAGE_LARGE)) == (PAGE_PRESENT | PAGE_LARGE)) {
+        vmm_split_large(dir_index);
+    }
+    
     // Check if page table exists
-    if (kernel_directory->entries[dir_index] & PAGE_PRESENT) {
-        if (flags & PAGE_USER) {
-        kernel_directory->entries[dir_index] |= PAGE_USER;
+    if (dir->entries[dir_index] & PAGE_PRESENT) {
+        if ((flags & PAGE_USER) && !(dir->entries[dir_index] & PAGE_USER)) {
+            vmm_set_pde(dir_index, dir->entries[dir_index] | PAGE_USER);
         }
 
-        // Extract physical address of page table
-        uint32_t table_phys = kernel_directory->entries[dir_index] & ~0xFFF;
-        vmm_require_idmapped((void*)table_phys, "page table (existing)");
-        return (page_table_t*)table_phys;
+        return vmm_table(dir_index);
     }
     
     // Create new page table if requested
     if (create) {
-        void *table_phys = pmm_alloc_frame();
+        void *table_phys = pmm_alloc_zeroed_frame_zone(vmm_table_zone());
         if (!table_phys) {
-            panicf("[vmm] ERROR: Failed to allocate page table\n");
+            klogf("[vmm] ERROR: Failed to allocate page table for 0x%08x\n", virt);
             return NULL;
         }
         
-        // Clear the page table
-        vmm_require_idmapped(table_phys, "page table");
-        memset((void*)table_phys, 0, sizeof(page_table_t));
-        
         uint32_t pde_flags = PAGE_PRESENT | PAGE_RW;
         if (flags & PAGE_USER) {
             pde_flags |= PAGE_USER;
         }
         
-        kernel_directory->entries[dir_index] = (uint32_t)table_phys | pde_flags;
+        vmm_set_pde(dir_index, (uint32_t)table_phys | pde_flags);
+        
+        page_table_t *table = vmm_table(dir_index);
+        if (directory_loaded) {
+            __asm__ volatile("invlpg (%0)" :: "r"(table) : "memory");
+        }
         
         kprintf("[vmm] Created page table at 0x%08x for virt 0x%08x (flags: 0x%x)\n",
               (uint32_t)table_phys, virt, pde_flags);
         
-        return (page_table_t*)table_phys;
+        return table;
     }
     
     return NULL;
 }
 
-void vmm_map_page(uint32_t virt, uint32_t phys, uint32_t flags) {
+int vmm_try_map_page(uint32_t virt, uint32_t phys, uint32_t flags) {
     // Align addresses
     virt &= ~0xFFF;
     phys &= ~0xFFF;
     
     page_table_t *table = get_page_table(virt, true, flags);
     if (!table) {
-        kprintf("vmm_map_page: Failed to get page table for 0x%08x", virt);
+        return -1;
     }
     
     uint32_t table_index = (virt >> 12) & 0x3FF;
@@ -85,7 +252,16 @@ void vmm_map_page(uint32_t virt, uint32_t phys, uint32_t flags) {
     table->entries[table_index] = phys | (flags & 0xFFF);
     
     // Invalidate TLB for this page
-    __asm__ volatile("invlpg (%0)" :: "r"(virt) : "memory");
+    if (directory_loaded) {
+        __asm__ volatile("invlpg (%0)" :: "r"(virt) : "memory");
+    }
+    return 0;
+}
+
+void vmm_map_page(uint32_t virt, uint32_t phys, uint32_t flags) {
+    if (vmm_try_map_page(virt, phys, flags) < 0) {
+        panicf("[vmm] ERROR: Failed to get page table for 0x%08x\n", virt);
+    }
 }
 
 void vmm_unmap_page(uint32_t virt) {
@@ -131,6 +307,11 @@ void vmm_free_page(uint32_t virt) {
 }
 
 uint32_t vmm_get_physical(uint32_t virt) {
+    uint32_t pde = vmm_directory()->entries[virt >> 22];
+    if ((pde & (PAGE_PRESENT | PAGE_LARGE)) == (PAGE_PRESENT | PAGE_LARGE)) {
+        return (pde & 0xFFC00000) | (virt & 0x3FFFFF);
+    }
+    
     page_table_t *table = get_page_table(virt, false, 0);
     if (!table) {
         return 0;  // Not mapped
@@ -151,30 +332,646 @@ bool vmm_is_mapped(uint32_t virt) {
     return vmm_get_physical(virt) != 0;
 }
 
+// ----------------- Range operations -----------------
+
+static void tlb_gather_add(tlb_gather_t *tlb, uint32_t virt, uint32_t old_pte) {
+    if (!directory_loaded || !(old_pte & PAGE_PRESENT)) {
+        return;
+    }
+
+    if (old_pte & PAGE_GLOBAL) {
+        tlb->global = true;
+    }
+
+    if (tlb->count < TLB_GATHER_MAX) {
+        tlb->addrs[tlb->count++] = virt;
+    } else {
+        tlb->full = true;
+    }
+}
+
+static void tlb_gather_flush(tlb_gather_t *tlb) {
+    if (tlb->full) {
+        if (tlb->global) {
+            // Toggling PGE drops global entries too
+            uint32_t cr4;
+            __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+            __asm__ volatile("mov %0, %%cr4" :: "r"(cr4 & ~CR4_PGE) : "memory");
+            __asm__ volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+        } else {
+            uint32_t cr3;
+            __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+            __asm__ volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+        }
+    } else {
+        for (uint32_t i = 0; i < tlb->count; i++) {
+            __asm__ volatile("invlpg (%0)" :: "r"(tlb->addrs[i]) : "memory");
+        }
+    }
+
+    tlb->count = 0;
+    tlb->full = false;
+    tlb->global = false;
+}
+
+// Pages from virt up to the end of its page table, capped at count
+static inline uint32_t chunk_pages(uint32_t virt, uint32_t count) {
+    uint32_t left = 1024 - ((virt >> 12) & 0x3FF);
+    return (count < left) ? count : left;
+}
+
+void vmm_map_range(uint32_t virt, void **frames, uint32_t count, uint32_t flags) {
+    tlb_gather_t tlb = {0};
+    virt &= ~0xFFF;
+
+    while (count > 0) {
+        uint32_t n = chunk_pages(virt, count);
+        page_table_t *table = get_page_table(virt, true, flags);
+        if (!table) {
+            panicf("[vmm] ERROR: Failed to get page table for 0x%08x\n", virt);
+        }
+        uint32_t index = (virt >> 12) & 0x3FF;
+
+        for (uint32_t i = 0; i < n; i++) {
+            tlb_gather_add(&tlb, virt + i * PAGE_SIZE, table->entries[index + i]);
+            table->entries[index + i] = ((uint32_t)frames[i] & ~0xFFF) | (flags & 0xFFF);
+        }
+
+        virt += n * PAGE_SIZE;
+        frames += n;
+        count -= n;
+    }
+
+    tlb_gather_flush(&tlb);
+}
+
+uint32_t vmm_unmap_range(uint32_t virt, uint32_t count, void **frames) {
+    tlb_gather_t tlb = {0};
+    uint32_t unmapped = 0;
+    virt &= ~0xFFF;
+
+    while (count > 0) {
+        uint32_t n = chunk_pages(virt, count);
+        page_table_t *table = get_page_table(virt, false, 0);
+
+        if (table) {
+            uint32_t index = (virt >> 12) & 0x3FF;
+
+            for (uint32_t i = 0; i < n; i++) {
+                uint32_t entry = table->entries[index + i];
+                if (!(entry & PAGE_PRESENT)) {
+                    continue;
+                }
+
+                tlb_gather_add(&tlb, virt + i * PAGE_SIZE, entry);
+                table->entries[index + i] = 0;
+
+                if (frames) {
+                    frames[unmapped] = (void*)(entry & ~0xFFF);
+                }
+                unmapped++;
+            }
+        }
+
+        virt += n * PAGE_SIZE;
+        count -= n;
+    }
+
+    tlb_gather_flush(&tlb);
+    return unmapped;
+}
+
+void vmm_free_range(uint32_t virt, uint32_t count) {
+    void *frames[VMM_FREE_BATCH];
+    virt &= ~0xFFF;
+
+    // Frames only go back to the PMM once no TLB entry can reach them
+    while (count > 0) {
+        uint32_t n = (count < VMM_FREE_BATCH) ? count : VMM_FREE_BATCH;
+
+        pmm_free_batch(vmm_unmap_range(virt, n, frames), frames);
+
+        virt += n * PAGE_SIZE;
+        count -= n;
+    }
+}
+
+void vmm_protect_range(uint32_t virt, uint32_t count, uint32_t flags) {
+    tlb_gather_t tlb = {0};
+    virt &= ~0xFFF;
+
+    while (count > 0) {
+        uint32_t n = chunk_pages(virt, count);
+        page_table_t *table = get_page_table(virt, false, 0);
+
+        if (table) {
+            uint32_t index = (virt >> 12) & 0x3FF;
+
+            for (uint32_t i = 0; i < n; i++) {
+                uint32_t entry = table->entries[index + i];
+                if (!(entry & PAGE_PRESENT)) {
+                    continue;
+                }
+
+                uint32_t updated = (entry & ~0xFFF) | (flags & 0xFFF);
+                if (updated != entry) {
+                    tlb_gather_add(&tlb, virt + i * PAGE_SIZE, entry);
+                    table->entries[index + i] = updated;
+                }
+            }
+        }
+
+        virt += n * PAGE_SIZE;
+        count -= n;
+    }
+
+    tlb_gather_flush(&tlb);
+}
+
+// ----------------- Address spaces -----------------
+
+typedef struct {
+    void *frames[VMM_FREE_BATCH];
+    uint32_t count;
+} free_gather_t;
+
+static void free_gather_add(free_gather_t *gather, uint32_t phys) {
+    gather->frames[gather->count++] = (void*)phys;
+    if (gather->count == VMM_FREE_BATCH) {
+        pmm_free_batch(gather->count, gather->frames);
+        gather->count = 0;
+    }
+}
+
+static void gather_table_frames(void *page, uint32_t arg) {
+    page_table_t *table = (page_table_t*)page;
+    free_gather_t *gather = (free_gather_t*)arg;
+
+    for (uint32_t i = 0; i < 1024; i++) {
+        if (table->entries[i] & PAGE_PRESENT) {
+            free_gather_add(gather, table->entries[i] & ~0xFFF);
+        }
+    }
+}
+
+address_space_t *vmm_create_address_space(void) {
+    if (!space_cache) {
+        space_cache = kmem_cache_create("address_space", sizeof(address_space_t), 0, 0, NULL);
+        if (!space_cache) {
+            return NULL;
+        }
+    }
+
+    address_space_t *space = kmem_cache_alloc(space_cache);
+    if (!space) {
+        return NULL;
+    }
+
+    void *dir_phys = pmm_alloc_zeroed_frame_zone(PMM_ZONE_DIRECT);
+    if (!dir_phys) {
+        klogf("[vmm] ERROR: Failed to allocate page directory\n");
+        kmem_cache_free(space_cache, space);
+        return NULL;
+    }
+
+    space->directory = (page_directory_t*)PHYS_TO_VIRT(dir_phys);
+    memset(&space->vmas, 0, sizeof(space->vmas));
+    vmm_sync_kernel_pdes(space);
+    space->directory->entries[VMM_RECURSIVE_PDE] = (uint32_t)dir_phys | PAGE_PRESENT | PAGE_RW;
+
+    return space;
+}
+
+// Share one user page table's pages with a fork child. Writable pages
+// become copy-on-write in the parent's table, then the table is copied
+// into the child's.
+static void copy_cow_table(void *page, uint32_t arg) {
+    page_table_t *child = (page_table_t*)page;
+    page_table_t *parent = (page_table_t*)arg;
+
+    for (uint32_t i = 0; i < 1024; i++) {
+        uint32_t entry = parent->entries[i];
+
+        if (entry & PAGE_PRESENT) {
+            if (entry & PAGE_RW) {
+                entry = (entry & ~PAGE_RW) | PAGE_COW;
+                parent->entries[i] = entry;
+            }
+
+            page_t *shared = pmm_phys_to_page((void*)(entry & ~0xFFF));
+            if (shared) {
+                page_get(shared);
+            }
+        }
+
+        child->entries[i] = entry;
+    }
+}
+
+address_space_t *vmm_clone_address_space(void) {
+    address_space_t *space = vmm_create_address_space();
+    if (!space) {
+        return NULL;
+    }
+
+    if (vma_table_copy(&space->vmas, &current_space->vmas) < 0) {
+        vmm_destroy_address_space(space);
+        return NULL;
+    }
+
+    page_directory_t *dir = vmm_directory();
+    int result = 0;
+
+    for (uint32_t i = USER_PDE_FIRST; i < USER_PDE_END; i++) {
+        uint32_t pde = dir->entries[i];
+        if (!(pde & PAGE_PRESENT)) {
+            continue;
+        }
+
+        void *table_phys = pmm_alloc_frame_zone(vmm_table_zone());
+        if (!table_phys) {
+            klogf("[vmm] ERROR: Out of memory for page tables of fork child\n");
+            result = -1;
+            break;
+        }
+
+        vmm_with_scratch((uint32_t)table_phys, copy_cow_table, (uint32_t)vmm_table(i));
+        space->directory->entries[i] = (uint32_t)table_phys | (pde & 0xFFF);
+    }
+
+    // Every writable user page of ours may have lost PAGE_RW. User entries
+    // are never global, so reloading CR3 drops them all.
+    uint32_t cr3;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+    __asm__ volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+
+    // Pages left PAGE_COW on our side are taken back on their next write
+    if (result < 0) {
+        vmm_destroy_address_space(space);
+        return NULL;
+    }
+
+    return space;
+}
+
+void vmm_switch(address_space_t *space) {
+    if (space->kernel_gen != kernel_pde_gen) {
+        vmm_sync_kernel_pdes(space);
+    }
+
+    current_space = space;
+    __asm__ volatile("mov %0, %%cr3" :: "r"(VIRT_TO_PHYS(space->directory)) : "memory");
+}
+
+void vmm_destroy_address_space(address_space_t *space) {
+    if (!space || space == &kernel_space) {
+        return;
+    }
+
+    if (space == current_space) {
+        vmm_switch(&kernel_space);
+    }
+
+    // Only the user half is private, kernel tables stay with everyone else
+    free_gather_t gather = { .count = 0 };
+    for (uint32_t i = USER_PDE_FIRST; i < USER_PDE_END; i++) {
+        uint32_t pde = space->directory->entries[i];
+        if (!(pde & PAGE_PRESENT)) {
+            continue;
+        }
+
+        vmm_with_scratch(pde & ~0xFFF, gather_table_frames, (uint32_t)&gather);
+        free_gather_add(&gather, pde & ~0xFFF);
+    }
+    pmm_free_batch(gather.count, gather.frames);
+
+    pmm_free_frame((void*)VIRT_TO_PHYS(space->directory));
+
+    vma_table_release(&space->vmas);
+
+    kmem_cache_free(space_cache, space);
+}
+
+address_space_t *vmm_current_space(void) {
+    return current_space;
+}
+
+address_space_t *vmm_kernel_space(void) {
+    return &kernel_space;
+}
+
+// ----------------- User areas -----------------
+
+int vmm_add_region(uint32_t start, uint32_t end, uint32_t flags, vma_backing_t backing) {
+    start &= ~0xFFF;
+    end = (end + 0xFFF) & ~0xFFF;
+    flags = (flags & 0xFFF) | PAGE_PRESENT | PAGE_USER;
+
+    if (start >= end || !vmm_is_user_range(start, end - start)) {
+        return -1;
+    }
+
+    vma_t area = { .start = start, .end = end, .flags = flags, .backing = backing };
+    return vma_insert(&current_space->vmas, &area);
+}
+
+int vmm_add_file_region(uint32_t start, uint32_t end, uint32_t flags,
+                        vma_file_t *file, uint32_t offset, uint32_t file_end) {
+    end = (end + 0xFFF) & ~0xFFF;
+    flags = (flags & 0xFFF) | PAGE_PRESENT | PAGE_USER;
+
+    if ((start & 0xFFF) || (offset & 0xFFF) || start >= end ||
+        !vmm_is_user_range(start, end - start)) {
+        return -1;
+    }
+
+    vma_t area = {
+        .start = start, .end = end, .flags = flags, .backing = VMA_FILE,
+        .file = file, .offset = offset, .file_end = file_end,
+    };
+    return vma_insert(&current_space->vmas, &area);
+}
+
+int vmm_protect_region(uint32_t start, uint32_t end, uint32_t flags) {
+    start &= ~0xFFF;
+    end = (end + 0xFFF) & ~0xFFF;
+    flags = (flags & 0xFFF) | PAGE_PRESENT | PAGE_USER;
+
+    if (start >= end || !vmm_is_user_range(start, end - start)) {
+        return -1;
+    }
+
+    return vma_protect(&current_space->vmas, start, end, flags);
+}
+
+int vmm_remove_region(uint32_t start, uint32_t end) {
+    start &= ~0xFFF;
+    end = (end + 0xFFF) & ~0xFFF;
+
+    if (start >= end) {
+        return 0;
+    }
+
+    if (vma_remove(&current_space->vmas, start, end) < 0) {
+        return -1;
+    }
+
+    vmm_free_range(start, (end - start) / PAGE_SIZE);
+    return 0;
+}
+
+static void copy_page(void *page, uint32_t src) {
+    memcpy(page, (const void*)src, PAGE_SIZE);
+}
+
+// Give the current space its own copy of a PAGE_COW page
+static int vmm_break_cow(uint32_t addr) {
+    addr &= ~0xFFF;
+
+    page_table_t *table = get_page_table(addr, false, 0);
+    if (!table) {
+        return -1;
+    }
+
+    uint32_t entry = table->entries[(addr >> 12) & 0x3FF];
+    if ((entry & (PAGE_PRESENT | PAGE_COW)) != (PAGE_PRESENT | PAGE_COW)) {
+        return -1;
+    }
+
+    uint32_t old = entry & ~0xFFF;
+    uint32_t flags = ((entry & 0xFFF) & ~PAGE_COW) | PAGE_RW;
+
+    // Everyone else has let go of it already, no copy needed
+    page_t *page = pmm_phys_to_page((void*)old);
+    if (page && page->refcount == 1) {
+        return vmm_try_map_page(addr, old, flags);
+    }
+
+    void *frame = pmm_alloc_frame();
+    if (!frame) {
+        klogf("[vmm] ERROR: Out of memory copying shared page 0x%08x\n", addr);
+        return -1;
+    }
+
+    vmm_with_scratch((uint32_t)frame, copy_page, addr);
+    if (vmm_try_map_page(addr, (uint32_t)frame, flags) < 0) {
+        pmm_free_frame(frame);
+        return -1;
+    }
+    pmm_free_frame((void*)old);
+    return 0;
+}
+
+// Fill a page of a file area from its file. Writable (data) pages get a
+// frame private to this address space; read-only ones come from or go to
+// the file's image when it has one.
+static int vmm_fault_file(const vma_t *vma, uint32_t addr) {
+    addr &= ~0xFFF;
+
+    // Whole read-only pages of an executable are shared through its image
+    image_t *image = vma->file->image;
+    uint32_t file_page = (vma->offset + (addr - vma->start)) / PAGE_SIZE;
+    bool shareable = image && !(vma->flags & PAGE_RW) && addr + PAGE_SIZE <= vma->file_end;
+
+    if (shareable) {
+        uint32_t cached = image_lookup(image, file_page);
+        if (cached) {
+            if (vmm_try_map_page(addr, cached, vma->flags) < 0) {
+                return -1;
+            }
+            page_get(pmm_phys_to_page((void*)cached));
+            return 0;
+        }
+    }
+
+    void *frame = pmm_alloc_frame();
+    if (!frame) {
+        klogf("[vmm] ERROR: Out of memory for file page 0x%08x\n", addr);
+        return -1;
+    }
+
+    // Kernel-only until it's filled, the user can't see a partial page.
+    // This creates the page table if needed, the final mapping below
+    // reuses it.
+    if (vmm_try_map_page(addr, (uint32_t)frame, PAGE_PRESENT | PAGE_RW) < 0) {
+        pmm_free_frame(frame);
+        return -1;
+    }
+
+    uint32_t len = 0;
+    if (addr < vma->file_end) {
+        len = vma->file_end - addr;
+        if (len > PAGE_SIZE) len = PAGE_SIZE;
+    }
+
+    if (len > 0) {
+        int n = vfs_file_pread(vma->file->file, (void*)addr, len, vma->offset + (addr - vma->start));
+        if (n < 0 || (uint32_t)n != len) {
+            klogf("[vmm] ERROR: Short read filling page 0x%08x (%d of %u bytes)\n", addr, n, len);
+            vmm_unmap_page(addr);
+            pmm_free_frame(frame);
+            return -1;
+        }
+    }
+
+    memset((void*)(addr + len), 0, PAGE_SIZE - len);
+
+    if (vmm_try_map_page(addr, (uint32_t)frame, vma->flags) < 0) {
+        vmm_unmap_page(addr);
+        pmm_free_frame(frame);
+        return -1;
+    }
+
+    if (shareable) {
+        image_insert(image, file_page, (uint32_t)frame);
+    }
+    return 0;
+}
+
+int vmm_handle_fault(uint32_t addr, uint32_t error) {
+    if (addr >= USER_SPACE_END) {
+        return -1;
+    }
+
+    // A present page means a protection violation, which only a write to
+    // a copy-on-write page can get past
+    if (error & PAGE_FAULT_PRESENT) {
+        return (error & PAGE_FAULT_WRITE) ? vmm_break_cow(addr) : -1;
+    }
+
+    vma_t *vma = vma_find(&current_space->vmas, addr);
+    if (!vma || vma->backing == VMA_LOADED) {
+        return -1;
+    }
+
+    if ((error & PAGE_FAULT_WRITE) && !(vma->flags & PAGE_RW)) {
+        return -1;
+    }
+
+    if (vma->backing == VMA_FILE) {
+        return vmm_fault_file(vma, addr);
+    }
+
+    void *frame = pmm_alloc_zeroed_frame();
+    if (!frame) {
+        klogf("[vmm] ERROR: Out of memory for demand-zero page 0x%08x\n", addr);
+        return -1;
+    }
+
+    if (vmm_try_map_page(addr, (uint32_t)frame, vma->flags) < 0) {
+        pmm_free_frame(frame);
+        return -1;
+    }
+    return 0;
+}
+
+bool vmm_check_user(uint32_t addr, uint32_t len, bool write) {
+    if (len == 0) {
+        return true;
+    }
+
+    if (!vmm_is_user_range(addr, len)) {
+        return false;
+    }
+
+    uint32_t flags = PAGE_USER | (write ? PAGE_RW : 0);
+    return vma_covers(&current_space->vmas, addr, addr + len, flags);
+}
+
+int32_t vmm_user_strlen(uint32_t addr, uint32_t max) {
+    uint32_t len = 0;
+
+    // Only the bytes inside an area are read, so a string running off the
+    // end of one can't fault in the kernel
+    while (len < max) {
+        vma_t *vma = vma_find(&current_space->vmas, addr + len);
+        if (!vma || addr + len < USER_SPACE_START) {
+            return -1;
+        }
+
+        uint32_t avail = vma->end - (addr + len);
+        if (avail > max - len) {
+            avail = max - len;
+        }
+
+        const char *str = (const char*)(addr + len);
+        for (uint32_t i = 0; i < avail; i++) {
+            if (str[i] == '\0') {
+                return (int32_t)(len + i);
+            }
+        }
+        len += avail;
+    }
+
+    return -1;
+}
+
+void vmm_zero_frame(uint32_t phys) {
+    vmm_with_scratch(phys & ~0xFFF, fill_zero, 0);
+}
+
 void vmm_init(void) {
     kprintf_both("[vmm] Initalizing Virtual Memory Manager...\n");
 
-    kernel_directory = (page_directory_t*)pmm_alloc_frame();
-    vmm_require_idmapped(kernel_directory, "page directory");
-    memset(kernel_directory, 0, sizeof(page_directory_t));
+    void *dir_phys = pmm_alloc_zeroed_frame_zone(PMM_ZONE_DIRECT);
+    if (!dir_phys) {
+        panicf("[vmm] ERROR: Failed to allocate page directory\n");
+    }
+    kernel_directory = (page_directory_t*)PHYS_TO_VIRT(dir_phys);
+    kernel_directory->entries[VMM_RECURSIVE_PDE] = (uint32_t)dir_phys | PAGE_PRESENT | PAGE_RW;
 
-    kprintf_both("[vmm] Identity mapping 0 -> 16 MB...\n");
+    kernel_space.directory = kernel_directory;
+    kernel_space.kernel_gen = 0;
+    current_space = &kernel_space;
 
-    for (uint32_t addr = 0; addr < 16 * 1024 * 1024; addr += PAGE_SIZE) {
-        vmm_map_page(addr, addr, PAGE_PRESENT | PAGE_RW);
-    }
+    // The direct map holds the kernel and its structures: use 4MB pages
+    // that stay in the TLB across address space switches where possible
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    pse_enabled = (edx & CPUID_FEAT_PSE) != 0;
+    pge_enabled = (edx & CPUID_FEAT_PGE) != 0;
 
-    kprintf_both("[vmm] Identity mapping complete!\n");
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (pse_enabled) cr4 |= CR4_PSE;
+    if (pge_enabled) cr4 |= CR4_PGE;
+    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
 
-    // Load page directory into CR3
-    __asm__ volatile("mov %0, %%cr3" :: "r"(kernel_directory) : "memory");
-    
-    // Enable paging (set PG bit in CR0)
+    // Make read-only pages read-only for the kernel too, so its writes to
+    // copy-on-write user pages fault like the user's own
     uint32_t cr0;
     __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
-    cr0 |= 0x80000000;
-    __asm__ volatile("mov %0, %%cr0" :: "r"(cr0) : "memory");
+    __asm__ volatile("mov %0, %%cr0" :: "r"(cr0 | CR0_WP) : "memory");
+
+    uint32_t direct_flags = PAGE_PRESENT | PAGE_RW | (pge_enabled ? PAGE_GLOBAL : 0);
+
+    kprintf_both("[vmm] Mapping 0 -> %u MB at 0x%08x (%s pages%s)...\n",
+                 DIRECT_MAP_LIMIT / (1024 * 1024), KERNEL_VIRT_BASE,
+                 pse_enabled ? "4MB" : "4KB", pge_enabled ? ", global" : "");
+
+    if (pse_enabled) {
+        for (uint32_t addr = 0; addr < DIRECT_MAP_LIMIT; addr += 0x400000) {
+            vmm_set_pde((KERNEL_VIRT_BASE + addr) >> 22, addr | direct_flags | PAGE_LARGE);
+        }
+    } else {
+        for (uint32_t addr = 0; addr < DIRECT_MAP_LIMIT; addr += PAGE_SIZE) {
+            vmm_map_page(KERNEL_VIRT_BASE + addr, addr, direct_flags);
+        }
+    }
+
+    kprintf_both("[vmm] Direct map complete!\n");
+
+    // Set up the scratch page's table now so vmm_zero_frame() never has
+    // to allocate one
+    if (!get_page_table(VMM_SCRATCH_VIRT, true, 0)) {
+        panicf("[vmm] ERROR: Failed to allocate the scratch page table\n");
+    }
+
+    // Leave the boot directory. Nothing below KERNEL_VIRT_BASE is mapped
+    // from here on, the whole low 3GB is left to user address spaces.
+    __asm__ volatile("mov %0, %%cr3" :: "r"(dir_phys) : "memory");
+    directory_loaded = true;
     
-    klogf("[vmm] Paging enabled (CR0.PG set)\n");
+    klogf("[vmm] Kernel page directory loaded (CR3 = 0x%08x)\n", (uint32_t)dir_phys);
     klogf("[vmm] Virtual Memory Manager initialized\n");
 }
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "vma.h"
 
 #define PAGE_SIZE 4096
 
@@ -12,11 +13,51 @@
 #define PAGE_USER     0x004
 #define PAGE_ACCESSED 0x020
 #define PAGE_DIRTY    0x040
+#define PAGE_LARGE    0x080   // Directory entry maps a 4MB page (needs PSE)
+#define PAGE_GLOBAL   0x100   // Kept in the TLB across CR3 loads (needs PGE)
+#define PAGE_COW      0x200   // Write-protected share of a writable page (OS bit)
 
-#define IDMAP_LIMIT (16 * 1024 * 1024)
+// Page fault error code bits
+#define PAGE_FAULT_PRESENT  0x1   // Page was present (protection violation)
+#define PAGE_FAULT_WRITE    0x2   // Faulting access was a write
+#define PAGE_FAULT_USER     0x4   // Fault happened in user mode
+
+// The kernel lives in the top 1GB of every address space, linked at
+// KERNEL_VIRT_BASE + 1MB. Physical memory below DIRECT_MAP_LIMIT (the DMA
+// zone, the kernel image and the PMM's DIRECT zone for slabs, arenas and
+// other kernel structures) is mapped at KERNEL_VIRT_BASE + phys. Page
+// tables are reached through the recursive mapping instead and can live
+// anywhere.
+#define KERNEL_VIRT_BASE  0xC0000000
+#define DIRECT_MAP_LIMIT  (32 * 1024 * 1024)
+
+// Convert between a physical address below DIRECT_MAP_LIMIT and its
+// address in the direct map
+#define PHYS_TO_VIRT(p)   ((void*)((uint32_t)(p) + KERNEL_VIRT_BASE))
+#define VIRT_TO_PHYS(v)   ((uint32_t)(v) - KERNEL_VIRT_BASE)
+
+// Everything below the kernel belongs to the address space. The first page
+// is never mapped so NULL dereferences fault in user mode as well.
+#define USER_SPACE_START  PAGE_SIZE
+#define USER_SPACE_END    KERNEL_VIRT_BASE
+
+// True if [addr, addr + len) lies entirely in the user half. The
+// subtraction wraps addresses below USER_SPACE_START around, so both
+// bounds of addr are checked in one compare.
+static inline bool vmm_is_user_range(uint32_t addr, uint32_t len) {
+    return addr - USER_SPACE_START < USER_SPACE_END - USER_SPACE_START &&
+           len <= USER_SPACE_END - addr;
+}
+
+// Opaque address space (page directory plus bookkeeping)
+typedef struct address_space address_space_t;
 
 /**
- * @brief Initialize VMM (creates kernel page directory, identity maps low memory, enables paging)
+ * @brief Initialize VMM (creates kernel page directory with the direct map and switches to it)
+ * 
+ * boot.S enters the kernel with a temporary directory that maps the first
+ * DIRECT_MAP_LIMIT bytes both at 0 and at KERNEL_VIRT_BASE. Until this runs,
+ * only the direct map may be used.
  */
 void vmm_init(void);
 
@@ -26,9 +67,24 @@ void vmm_init(void);
  * @param virt Virtual address to map (will be page-aligned)
  * @param phys Physical address to map to (should be from pmm_alloc_frame())
  * @param flags Page flags (PAGE_PRESENT | PAGE_RW | etc.)
+ * 
+ * @warning Panics if the page table can't be allocated
  */
 void vmm_map_page(uint32_t virt, uint32_t phys, uint32_t flags);
 
+/**
+ * @brief Map a virtual address, failing instead of panicking
+ * 
+ * vmm_map_page() panics when it can't allocate the page table. Paths
+ * that can report an error (user page faults) use this instead.
+ * 
+ * @param virt Virtual address to map (will be page-aligned)
+ * @param phys Physical address to map to
+ * @param flags Page flags (PAGE_PRESENT | PAGE_RW | etc.)
+ * @return 0 on success, -1 if out of memory for the page table
+ */
+int vmm_try_map_page(uint32_t virt, uint32_t phys, uint32_t flags);
+
 /**
  * @brief Unmap a virtual address
  * 
@@ -69,4 +125,205 @@ uint32_t vmm_get_physical(uint32_t virt);
  */
 bool vmm_is_mapped(uint32_t virt);
 
+/**
+ * @brief Map a run of pages
+ * 
+ * Maps count pages starting at virt to frames[0..count-1], walking each
+ * page table once and invalidating the TLB only for pages that were
+ * already mapped.
+ * 
+ * @param virt First virtual address (will be page-aligned)
+ * @param frames Physical frames, one per page
+ * @param count Number of pages
+ * @param flags Page flags
+ */
+void vmm_map_range(uint32_t virt, void **frames, uint32_t count, uint32_t flags);
+
+/**
+ * @brief Unmap a run of pages
+ * 
+ * Does NOT free the frames. Pages that are not mapped are skipped.
+ * 
+ * @param virt First virtual address (will be page-aligned)
+ * @param count Number of pages
+ * @param frames If not NULL, receives the frames that were mapped (room for count)
+ * @return Number of pages that were mapped
+ */
+uint32_t vmm_unmap_range(uint32_t virt, uint32_t count, void **frames);
+
+/**
+ * @brief Unmap a run of pages and free their frames
+ * 
+ * @param virt First virtual address (will be page-aligned)
+ * @param count Number of pages
+ */
+void vmm_free_range(uint32_t virt, uint32_t count);
+
+/**
+ * @brief Change the flags of every mapped page in a run
+ * 
+ * @param virt First virtual address (will be page-aligned)
+ * @param count Number of pages
+ * @param flags New page flags (PAGE_PRESENT must be included)
+ */
+void vmm_protect_range(uint32_t virt, uint32_t count, uint32_t flags);
+
+/**
+ * @brief Create an address space
+ * 
+ * The new address space has an empty user half and shares the kernel's
+ * page tables for everything else.
+ * 
+ * @return New address space, or NULL if out of memory
+ */
+address_space_t *vmm_create_address_space(void);
+
+/**
+ * @brief Make an address space the current one (loads CR3)
+ * 
+ * @param space Address space to switch to
+ */
+void vmm_switch(address_space_t *space);
+
+/**
+ * @brief Destroy an address space
+ * 
+ * Frees every frame mapped in its user half, its user page tables and its
+ * directory. Switches to the kernel address space first if it is current.
+ * The kernel address space can't be destroyed.
+ * 
+ * @param space Address space to destroy
+ */
+void vmm_destroy_address_space(address_space_t *space);
+
+/**
+ * @brief Copy the current address space for fork
+ * 
+ * The copy gets its own page tables and a copy of the areas, but no user
+ * frames are copied: every mapped page is shared by both spaces, and
+ * writable ones are write-protected and marked PAGE_COW in both. The
+ * first write to such a page from either side gets a private copy (see
+ * vmm_handle_fault()). Frame reference counts track the sharing.
+ * 
+ * @return New address space, or NULL if out of memory
+ */
+address_space_t *vmm_clone_address_space(void);
+
+/**
+ * @brief Get the current address space
+ */
+address_space_t *vmm_current_space(void);
+
+/**
+ * @brief Get the kernel's own address space (the one set up at boot)
+ */
+address_space_t *vmm_kernel_space(void);
+
+/**
+ * @brief Add an area to the current address space
+ * 
+ * VMA_ANON areas are demand-zero: nothing is allocated up front and each
+ * page gets a zeroed frame the first time it is touched. VMA_LOADED areas
+ * are mapped by the caller, a fault inside one is an error. The range is
+ * rounded out to whole pages and must lie in the user half without
+ * overlapping another area; an area adjacent to one with the same flags
+ * and backing is merged into it.
+ * 
+ * @param start First address of the area
+ * @param end End of the area (exclusive)
+ * @param flags Page flags of the area's pages (PAGE_PRESENT and PAGE_USER
+ *              are implied)
+ * @param backing What provides the pages
+ * @return 0 on success, -1 if out of range, overlapping or out of memory
+ */
+int vmm_add_region(uint32_t start, uint32_t end, uint32_t flags, vma_backing_t backing);
+
+/**
+ * @brief Add a file area to the current address space
+ * 
+ * Nothing is read up front. The first touch of a page reads its part of
+ * the file into a fresh frame private to this address space, zeroing
+ * whatever lies at or above file_end. Read-only areas of a file with an
+ * image map the image's frame instead when it has the page already.
+ * 
+ * @param start First address of the area (page aligned)
+ * @param end End of the area (exclusive)
+ * @param flags Page flags of the area's pages (PAGE_PRESENT and PAGE_USER
+ *              are implied)
+ * @param file File the pages come from (the area takes a reference)
+ * @param offset File position of start (page aligned)
+ * @param file_end Address where the file data ends
+ * @return 0 on success, -1 if misaligned, out of range, overlapping or
+ *         out of memory
+ */
+int vmm_add_file_region(uint32_t start, uint32_t end, uint32_t flags,
+                        vma_file_t *file, uint32_t offset, uint32_t file_end);
+
+/**
+ * @brief Change the flags of a range of the current address space's areas
+ * 
+ * Only the areas change, mapped pages keep their PTEs (see
+ * vmm_protect_range() for those).
+ * 
+ * @param start First address of the range
+ * @param end End of the range (exclusive)
+ * @param flags New page flags (PAGE_PRESENT and PAGE_USER are implied)
+ * @return 0 on success, -1 if part of the range is in no area or out of
+ *         memory
+ */
+int vmm_protect_region(uint32_t start, uint32_t end, uint32_t flags);
+
+/**
+ * @brief Drop a range from the current address space's areas
+ * 
+ * Areas are trimmed or split as needed. Every page mapped in the range
+ * is unmapped and its frame freed, whatever backed it.
+ * 
+ * @param start First address of the range
+ * @param end End of the range (exclusive)
+ * @return 0 on success, -1 if out of memory splitting an area
+ */
+int vmm_remove_region(uint32_t start, uint32_t end);
+
+/**
+ * @brief Try to resolve a page fault
+ * 
+ * Called by the page fault handler. A missing page inside a VMA_ANON area
+ * of the current address space gets a zeroed frame, one inside a VMA_FILE
+ * area is read from its file, and a write to a PAGE_COW page gets a
+ * private copy (or the frame itself once no other space shares it).
+ * Anything else (protection violations, writes to read-only areas,
+ * addresses outside any area) is left to the caller.
+ * 
+ * @param addr Faulting address (CR2)
+ * @param error Error code pushed by the CPU (PAGE_FAULT_* bits)
+ * @return 0 if the faulting access can be retried, -1 otherwise
+ */
+int vmm_handle_fault(uint32_t addr, uint32_t error);
+
+/**
+ * @brief Check a user buffer before the kernel touches it
+ * 
+ * @param addr Start of the buffer
+ * @param len Length in bytes
+ * @param write Whether the kernel will write to it
+ * @return true if the whole buffer lies in areas of the current address
+ *         space that allow the access
+ */
+bool vmm_check_user(uint32_t addr, uint32_t len, bool write);
+
+/**
+ * @brief Measure a user string without reading outside its areas
+ * 
+ * @param addr Start of the string
+ * @param max Longest length accepted
+ * @return Length without the terminator, or -1 if the string leaves the
+ *         current address space's areas or is longer than max
+ */
+int32_t vmm_user_strlen(uint32_t addr, uint32_t max);
+
+// Zero one physical frame, wherever it lives (frames above DIRECT_MAP_LIMIT are
+// reached through a scratch mapping)
+void vmm_zero_frame(uint32_t phys);
+
 #endif // VMM_H
\ No newline at end of file